@@ -0,0 +1,218 @@
+#include "devices/timeout.h"
+#include <debug.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+
+/* The wheel has WHEEL_LEVELS levels of WHEEL_SIZE slots each.
+   A slot at level L covers WHEEL_SIZE**L ticks, so level 0 holds
+   the timeouts due within the next WHEEL_SIZE ticks, level 1
+   those due within WHEEL_SIZE**2 ticks, and so on.  Whenever the
+   level-0 index wraps around, the next slot of level 1 is
+   "cascaded": its timeouts are re-inserted, which moves them
+   down to level 0.  Higher levels cascade the same way. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+/* Longest delay the wheel can represent directly.  Timeouts
+   further away are parked in the last slot in range and
+   re-inserted when it cascades. */
+#define WHEEL_RANGE ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* Last tick processed by timeout_advance(). */
+static int64_t wheel_now;
+
+/* Number of pending timeouts. */
+static size_t pending_cnt;
+
+static void wheel_insert (struct timeout *);
+static void cascade (int level);
+static void run_slot (struct list *);
+
+/* Initializes the timer wheel. */
+void
+timeout_wheel_init (void) {
+	int level, slot;
+
+	for (level = 0; level < WHEEL_LEVELS; level++)
+		for (slot = 0; slot < WHEEL_SIZE; slot++)
+			list_init (&wheel[level][slot]);
+	wheel_now = timer_ticks ();
+	pending_cnt = 0;
+}
+
+/* Initializes timeout T to call FUNC with AUX when it fires. */
+void
+timeout_init (struct timeout *t, timeout_func *func, void *aux) {
+	ASSERT (t != NULL);
+	ASSERT (func != NULL);
+
+	t->func = func;
+	t->aux = aux;
+	t->expires = 0;
+	t->pending = false;
+}
+
+/* Arms timeout T to fire TICKS timer ticks from now.  A TICKS
+   value of 0 or less fires at the next tick.  T must not already
+   be pending.
+
+   This function may be called from an interrupt handler. */
+void
+timeout_add (struct timeout *t, int64_t ticks) {
+	enum intr_level old_level;
+
+	ASSERT (t != NULL);
+	ASSERT (!t->pending);
+
+	old_level = intr_disable ();
+	t->expires = wheel_now + (ticks > 0 ? ticks : 1);
+	t->pending = true;
+	pending_cnt++;
+	wheel_insert (t);
+	intr_set_level (old_level);
+}
+
+/* Cancels timeout T.  Returns true if T was pending, false if it
+   had already fired or was never armed.
+
+   This function may be called from an interrupt handler. */
+bool
+timeout_cancel (struct timeout *t) {
+	enum intr_level old_level;
+	bool was_pending;
+
+	ASSERT (t != NULL);
+
+	old_level = intr_disable ();
+	was_pending = t->pending;
+	if (was_pending) {
+		list_remove (&t->elem);
+		t->pending = false;
+		pending_cnt--;
+	}
+	intr_set_level (old_level);
+
+	return was_pending;
+}
+
+/* Returns true if T is armed and has not fired yet. */
+bool
+timeout_pending (const struct timeout *t) {
+	ASSERT (t != NULL);
+
+	return t->pending;
+}
+
+/* Fires every timeout due at or before tick NOW, one tick at a
+   time.  Called by the timer interrupt handler with interrupts
+   off. */
+void
+timeout_advance (int64_t now) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	while (wheel_now < now) {
+		int64_t idx;
+		int level;
+
+		wheel_now++;
+		idx = wheel_now;
+		for (level = 1; level < WHEEL_LEVELS && (idx & WHEEL_MASK) == 0;
+				level++) {
+			idx >>= WHEEL_BITS;
+			cascade (level);
+		}
+		run_slot (&wheel[0][wheel_now & WHEEL_MASK]);
+	}
+}
+
+/* Returns the number of ticks, at most LIMIT, that may pass
+   before some timeout needs attention.  Used by the timer to
+   decide how long an idle CPU may sleep. */
+int64_t
+timeout_ticks_until_next (int64_t limit) {
+	int64_t k;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (pending_cnt == 0)
+		return limit;
+
+	for (k = 1; k < limit; k++) {
+		int64_t tick = wheel_now + k;
+		if ((tick & WHEEL_MASK) == 0
+				|| !list_empty (&wheel[0][tick & WHEEL_MASK]))
+			return k;
+	}
+	return limit;
+}
+
+/* Puts pending timeout T into the slot that matches how far in
+   the future it expires.  A timeout that is already due, which
+   happens when it cascades down in the tick it expires, goes
+   into the current level-0 slot, which timeout_advance() runs
+   right after cascading. */
+static void
+wheel_insert (struct timeout *t) {
+	int64_t when = t->expires;
+	int64_t delta;
+	int level;
+
+	if (when <= wheel_now) {
+		list_push_back (&wheel[0][wheel_now & WHEEL_MASK], &t->elem);
+		return;
+	}
+	delta = when - wheel_now;
+	if (delta >= WHEEL_RANGE) {
+		when = wheel_now + WHEEL_RANGE - 1;
+		delta = WHEEL_RANGE - 1;
+	}
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+			break;
+
+	list_push_back (&wheel[level][(when >> (WHEEL_BITS * level)) & WHEEL_MASK],
+			&t->elem);
+}
+
+/* Re-inserts the timeouts in the current slot of LEVEL, moving
+   them to lower levels. */
+static void
+cascade (int level) {
+	struct list *slot =
+		&wheel[level][(wheel_now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	struct list moving;
+
+	list_init (&moving);
+	while (!list_empty (slot))
+		list_push_back (&moving, list_pop_front (slot));
+	while (!list_empty (&moving))
+		wheel_insert (list_entry (list_pop_front (&moving),
+					struct timeout, elem));
+}
+
+/* Fires the due timeouts in level-0 SLOT. */
+static void
+run_slot (struct list *slot) {
+	struct list later;
+
+	list_init (&later);
+	while (!list_empty (slot)) {
+		struct timeout *t = list_entry (list_pop_front (slot),
+				struct timeout, elem);
+		if (t->expires > wheel_now) {
+			list_push_back (&later, &t->elem);
+			continue;
+		}
+
+		t->pending = false;
+		pending_cnt--;
+		t->func (t->aux);
+	}
+	while (!list_empty (&later))
+		wheel_insert (list_entry (list_pop_front (&later),
+					struct timeout, elem));
+}
@@ -3,10 +3,12 @@
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
+#include "devices/timeout.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
 
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -17,9 +19,38 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
+/* 8254 input frequency. */
+#define PIT_HZ 1193180
+
+/* 8254 counts per timer tick, rounded to nearest. */
+#define PIT_TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Longest one-shot period, in timer ticks, that fits in the
+   8254's 16-bit counter. */
+#define ONESHOT_MAX_TICKS (0xffff / PIT_TICK_COUNT)
+
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* List of sleeping threads, in order of increasing wakeup tick.
+   Threads with equal wakeup ticks are kept in FIFO order. */
+static struct list sleep_list;
+
+/* Number of timer ticks covered by the armed one-shot period,
+   or 0 if the 8254 is in its normal periodic mode. */
+static int64_t oneshot_ticks;
+
+/* 8254 counts of one-shot periods cut short that do not add up
+   to a whole tick yet. */
+static unsigned oneshot_carry;
+
+/* Statistics. */
+static int64_t interrupt_cnt;     /* # of timer interrupts taken. */
+static int64_t idle_wakeups;      /* # of one-shot periods ended. */
+static int64_t idle_ticks;        /* # of ticks spent in one-shot periods. */
+static uint64_t handler_cycles;   /* TSC cycles spent in timer_interrupt(). */
+static uint64_t handler_max_cycles; /* Longest timer_interrupt() call. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -28,19 +59,20 @@ static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
+static void pit_set_periodic (void);
+static void pit_set_oneshot (int64_t ticks);
+static void advance_ticks (int64_t cnt);
+static bool wakeup_less (const struct list_elem *, const struct list_elem *,
+		void *aux);
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
    interrupt PIT_FREQ times per second, and registers the
    corresponding interrupt. */
 void
 timer_init (void) {
-	/* 8254 input frequency divided by TIMER_FREQ, rounded to
-	   nearest. */
-	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
-
-	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
-	outb (0x40, count & 0xff);
-	outb (0x40, count >> 8);
+	list_init (&sleep_list);
+	timeout_wheel_init ();
+	pit_set_periodic ();
 
 	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -87,14 +119,24 @@ timer_elapsed (int64_t then) {
 	return timer_ticks () - then;
 }
 
-/* Suspends execution for approximately TICKS timer ticks. */
+/* Suspends execution for approximately TICKS timer ticks.
+   The thread is blocked on sleep_list and woken up by the timer
+   interrupt, so it does not use the CPU while it sleeps. */
 void
 timer_sleep (int64_t ticks) {
 	int64_t start = timer_ticks ();
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
 
 	ASSERT (intr_get_level () == INTR_ON);
-	while (timer_elapsed (start) < ticks)
-		thread_yield ();
+	if (ticks <= 0)
+		return;
+
+	old_level = intr_disable ();
+	curr->wakeup_tick = start + ticks;
+	list_insert_ordered (&sleep_list, &curr->elem, wakeup_less, NULL);
+	thread_block ();
+	intr_set_level (old_level);
 }
 
 /* Suspends execution for approximately MS milliseconds. */
@@ -118,14 +160,164 @@ timer_nsleep (int64_t ns) {
 /* Prints timer statistics. */
 void
 timer_print_stats (void) {
-	printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+	printf ("Timer: %"PRId64" ticks, %"PRId64" interrupts, "
+			"%"PRId64" idle ticks in %"PRId64" idle wakeups\n",
+			timer_ticks (), interrupt_cnt, idle_ticks, idle_wakeups);
 }
 
+/* Stores the time spent in the timer interrupt handler so far
+   into STATS. */
+void
+timer_get_handler_stats (struct timer_handler_stats *stats) {
+	enum intr_level old_level = intr_disable ();
+	stats->interrupts = interrupt_cnt;
+	stats->cycles = handler_cycles;
+	stats->max_cycles = handler_max_cycles;
+	intr_set_level (old_level);
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  If no thread needs to wake up within the next
+   tick, reprograms the 8254 to interrupt once at the earliest
+   wakeup tick (or as late as the counter allows) instead of
+   every tick. */
+void
+timer_idle_enter (void) {
+	int64_t delta = ONESHOT_MAX_TICKS;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (oneshot_ticks != 0)
+		return;
+
+	if (!list_empty (&sleep_list)) {
+		struct thread *t = list_entry (list_front (&sleep_list),
+				struct thread, elem);
+		if (t->wakeup_tick - ticks < delta)
+			delta = t->wakeup_tick - ticks;
+	}
+	delta = timeout_ticks_until_next (delta);
+
+	if (delta > 1)
+		pit_set_oneshot (delta);
+}
+
+/* Called by the idle thread, with interrupts off, after an
+   interrupt other than the timer's woke it up.  Cancels the
+   one-shot period, if one is still armed, accounts for the time
+   that has elapsed so far and returns the 8254 to periodic
+   mode.  Parts of a tick are carried over to the next cancelled
+   period, so that the tick count does not fall behind. */
+void
+timer_idle_exit (void) {
+	int64_t programmed, counted, elapsed;
+	uint16_t remaining;
+	uint8_t status;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (oneshot_ticks == 0)
+		return;
+
+	outb (0x43, 0xc2);    /* Read-back: latch status and count of counter 0. */
+	status = inb (0x40);
+	remaining = inb (0x40);
+	remaining |= inb (0x40) << 8;
+
+	/* Once the count expires OUT goes high and IRQ0 is pending.
+	   Leave the period armed, so that timer_interrupt() accounts
+	   for it as soon as interrupts are back on. */
+	if (status & 0x80)
+		return;
+
+	programmed = oneshot_ticks * PIT_TICK_COUNT;
+	counted = programmed - remaining + oneshot_carry;
+	elapsed = counted / PIT_TICK_COUNT;
+	oneshot_carry = counted % PIT_TICK_COUNT;
+
+	idle_wakeups++;
+	idle_ticks += elapsed;
+	oneshot_ticks = 0;
+	pit_set_periodic ();
+	advance_ticks (elapsed);
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED) {
-	ticks++;
-	thread_tick ();
+	uint64_t start = rdtsc ();
+	uint64_t cycles;
+	int64_t cnt = 1;
+
+	interrupt_cnt++;
+	if (oneshot_ticks != 0) {
+		cnt = oneshot_ticks;
+		idle_wakeups++;
+		idle_ticks += cnt;
+		oneshot_ticks = 0;
+		pit_set_periodic ();
+	}
+	advance_ticks (cnt);
+
+	cycles = rdtsc () - start;
+	handler_cycles += cycles;
+	if (cycles > handler_max_cycles)
+		handler_max_cycles = cycles;
+}
+
+/* Advances the tick count by CNT ticks, running the scheduler's
+   per-tick work for each one, wakes up every sleeping thread
+   whose wakeup tick has been reached and fires due timeouts.
+   Interrupts must be off. */
+static void
+advance_ticks (int64_t cnt) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	while (cnt-- > 0) {
+		ticks++;
+		thread_tick ();
+		timeout_advance (ticks);
+	}
+
+	while (!list_empty (&sleep_list)) {
+		struct thread *t = list_entry (list_front (&sleep_list),
+				struct thread, elem);
+		if (t->wakeup_tick > ticks)
+			break;
+
+		list_pop_front (&sleep_list);
+		thread_unblock (t);
+	}
+
+	thread_preempt ();
+}
+
+/* Programs the 8254 to interrupt TIMER_FREQ times per second. */
+static void
+pit_set_periodic (void) {
+	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
+	outb (0x40, PIT_TICK_COUNT & 0xff);
+	outb (0x40, PIT_TICK_COUNT >> 8);
+}
+
+/* Programs the 8254 to interrupt once, CNT timer ticks from now,
+   and records the period in oneshot_ticks. */
+static void
+pit_set_oneshot (int64_t cnt) {
+	uint16_t count = cnt * PIT_TICK_COUNT;
+
+	ASSERT (cnt > 0 && cnt <= ONESHOT_MAX_TICKS);
+	oneshot_ticks = cnt;
+	outb (0x43, 0x30);    /* CW: counter 0, LSB then MSB, mode 0, binary. */
+	outb (0x40, count & 0xff);
+	outb (0x40, count >> 8);
+}
+
+/* Orders threads on sleep_list by wakeup tick. */
+static bool
+wakeup_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = list_entry (a_, struct thread, elem);
+	const struct thread *b = list_entry (b_, struct thread, elem);
+
+	return a->wakeup_tick < b->wakeup_tick;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -0,0 +1,39 @@
+#ifndef DEVICES_TIMEOUT_H
+#define DEVICES_TIMEOUT_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A one-shot timeout, driven by the timer interrupt.
+
+   Pending timeouts are kept in a hashed hierarchical timer wheel,
+   so adding and cancelling a timeout take constant time and the
+   per-tick cost does not depend on how many timeouts are
+   pending.
+
+   The callback runs with interrupts off, usually from the timer
+   interrupt handler, so it must not sleep.  A struct timeout must
+   stay allocated until it has fired or been cancelled. */
+
+typedef void timeout_func (void *aux);
+
+struct timeout {
+	struct list_elem elem;      /* Element in a wheel slot. */
+	int64_t expires;            /* Tick at which to fire. */
+	timeout_func *func;         /* Function to call. */
+	void *aux;                  /* Auxiliary data for FUNC. */
+	bool pending;               /* Armed and not yet fired? */
+};
+
+void timeout_init (struct timeout *, timeout_func *, void *aux);
+void timeout_add (struct timeout *, int64_t ticks);
+bool timeout_cancel (struct timeout *);
+bool timeout_pending (const struct timeout *);
+
+/* Used by devices/timer.c. */
+void timeout_wheel_init (void);
+void timeout_advance (int64_t now);
+int64_t timeout_ticks_until_next (int64_t limit);
+
+#endif /* devices/timeout.h */
@@ -18,6 +18,18 @@ void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
 
+/* Time spent in the timer interrupt handler. */
+struct timer_handler_stats {
+	int64_t interrupts;         /* # of timer interrupts taken. */
+	uint64_t cycles;            /* Total TSC cycles spent in the handler. */
+	uint64_t max_cycles;        /* Longest single run of the handler. */
+};
+
+void timer_get_handler_stats (struct timer_handler_stats *);
+
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
@@ -0,0 +1,73 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Balanced binary search tree.
+ *
+ * This is a red-black tree.  Like the doubly linked list in
+ * list.h, it does not require dynamically allocated memory:
+ * each structure that can be in a tree embeds a struct rb_elem
+ * member, and rb_entry() converts an rb_elem back to the
+ * structure that contains it.
+ *
+ * The tree is ordered by a caller-supplied "less" function.
+ * Inserting, removing, and looking up an element take O(log n)
+ * time in the worst case, and the elements can be visited in
+ * order with rb_first() and rb_next().  A tree holds at most
+ * one element of each key.
+ *
+ * An element's key must not change while the element is in a
+ * tree.  To change a key, remove the element, change the key,
+ * and insert it again. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree element. */
+struct rb_elem {
+	struct rb_elem *parent;     /* Parent, or NULL for the root. */
+	struct rb_elem *left;       /* Left child, with smaller keys. */
+	struct rb_elem *right;      /* Right child, with larger keys. */
+	bool red;                   /* Red or black? */
+};
+
+/* Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool rb_less_func (const struct rb_elem *a,
+                           const struct rb_elem *b,
+                           void *aux);
+
+/* Tree. */
+struct rbtree {
+	struct rb_elem *root;       /* Root, or NULL if empty. */
+	size_t size;                /* Number of elements. */
+	rb_less_func *less;         /* Comparison function. */
+	void *aux;                  /* Auxiliary data for `less'. */
+};
+
+/* Converts pointer to tree element RB_ELEM into a pointer to
+   the structure that RB_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the tree element. */
+#define rb_entry(RB_ELEM, STRUCT, MEMBER)               \
+	((STRUCT *) ((uint8_t *) &(RB_ELEM)->parent     \
+		- offsetof (STRUCT, MEMBER.parent)))
+
+void rb_init (struct rbtree *, rb_less_func *, void *aux);
+
+struct rb_elem *rb_insert (struct rbtree *, struct rb_elem *);
+void rb_remove (struct rbtree *, struct rb_elem *);
+
+struct rb_elem *rb_find (const struct rbtree *, const struct rb_elem *);
+struct rb_elem *rb_floor (const struct rbtree *, const struct rb_elem *);
+
+struct rb_elem *rb_first (const struct rbtree *);
+struct rb_elem *rb_last (const struct rbtree *);
+struct rb_elem *rb_next (const struct rb_elem *);
+struct rb_elem *rb_prev (const struct rb_elem *);
+
+size_t rb_size (const struct rbtree *);
+bool rb_empty (const struct rbtree *);
+
+#endif /* lib/kernel/rbtree.h */
@@ -36,6 +36,9 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Debugging. */
+	SYS_SCHED_TRACE,            /* Print the scheduler trace. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,79 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/tlb.h"
+
+/* Maximum number of CPUs supported. */
+#define CPU_MAX 16
+
+/* Per-CPU data.
+
+   cpu_init() finds the processors listed in the BIOS's MP
+   configuration table, and cpu_start_aps() can start the
+   application processors.  Each one comes up in long mode on the
+   kernel's page table, in an idle thread of its own, and stays
+   parked with interrupts off: only the bootstrap processor,
+   cpus[0], schedules threads so far.  Until the others can too,
+   main() does not start them, since parked CPUs only make
+   cpu_current() read the local APIC on every call. */
+struct cpu {
+	int id;                             /* Index in cpus[]. */
+	uint8_t apic_id;                    /* Local APIC ID. */
+	bool online;                        /* Running the kernel? */
+
+	/* Owned by thread.c. */
+	struct spinlock lock;               /* Protects the run queue. */
+	struct list ready_queues[PRI_MAX + 1]; /* FIFO per priority. */
+	uint64_t ready_bitmap;              /* Non-empty ready_queues. */
+	int ready_cnt;                      /* # of threads in the run queue. */
+	struct thread *wakeup_stack;        /* Woken from interrupts. */
+	struct thread *idle_thread;         /* This CPU's idle thread. */
+	unsigned thread_ticks;              /* # of timer ticks since last yield. */
+	long long idle_ticks;               /* # of timer ticks spent idle. */
+	long long kernel_ticks;             /* # of timer ticks in kernel threads. */
+	long long user_ticks;               /* # of timer ticks in user programs. */
+	long long steals;                   /* # of times it took threads. */
+	long long migrations;               /* # of threads it took. */
+
+	/* Owned by tlb.c. */
+	struct tlb_asid asids[TLB_ASIDS];   /* PCIDs 1...TLB_ASIDS. */
+	uint64_t asid_clock;                /* Address space switches. */
+	bool base_stale;                    /* Flush PCID 0 on next use? */
+
+	/* Owned by palloc.c. */
+	struct palloc_cache palloc_caches[2]; /* Kernel pool, user pool. */
+};
+
+extern struct cpu cpus[CPU_MAX];
+extern int cpu_cnt;
+
+/* The local APIC registers of the CPU that reads them, or a null
+   pointer before cpu_init() maps them, and the index in cpus[]
+   of each local APIC ID. */
+extern volatile uint32_t *lapic;
+extern uint8_t cpu_by_apic_id[256];
+
+/* Local APIC ID register, as an index into lapic[]. */
+#define LAPIC_ID (0x020 / 4)
+
+void cpu_init (void);
+void cpu_start_aps (void);
+int cpu_online_cnt (void);
+
+/* Returns the CPU we are running on.  The caller must keep
+   interrupts off for as long as it uses the result, so that it
+   cannot be moved to another CPU. */
+static inline struct cpu *
+cpu_current (void) {
+	if (lapic == NULL)
+		return &cpus[0];
+	return &cpus[cpu_by_apic_id[lapic[LAPIC_ID] >> 24]];
+}
+
+#endif /* threads/cpu.h */
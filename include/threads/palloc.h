@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -11,6 +12,25 @@ enum palloc_flags {
 	PAL_USER = 004              /* User page. */
 };
 
+/* Each CPU keeps a cache of free single pages in front of each
+   pool.  An empty cache is refilled with PALLOC_CACHE_BATCH
+   pages at once, and a cache that reaches PALLOC_CACHE_HIGH
+   pages gives its oldest pages back until PALLOC_CACHE_LOW are
+   left, so the pool lock is taken once per batch rather than
+   once per page. */
+#define PALLOC_CACHE_HIGH 64
+#define PALLOC_CACHE_LOW 32
+#define PALLOC_CACHE_BATCH 16
+
+/* One CPU's cache of free pages from one pool. */
+struct palloc_cache {
+	size_t cnt;                     /* Number of pages cached. */
+	void *pages[PALLOC_CACHE_HIGH]; /* Oldest first. */
+	long long hits;                 /* Requests served from the cache. */
+	long long refills;              /* Requests that refilled it. */
+	long long drains;               /* Frees that drained it. */
+};
+
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
@@ -19,5 +39,7 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_prezero (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
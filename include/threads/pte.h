@@ -39,7 +39,15 @@
 #define PTE_P 0x1                        /* 1=present, 0=not present. */
 #define PTE_W 0x2                        /* 1=read/write, 0=read-only. */
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
+#define PTE_PWT 0x8                      /* 1=write-through caching. */
+#define PTE_PCD 0x10                     /* 1=caching disabled. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=large page (PDEs and PDPEs only). */
+
+/* Sizes of the pages mapped by a PDE and by a PDPE with PTE_PS
+   set. */
+#define LARGE_PGSIZE (1UL << PDXSHIFT)   /* 2 MiB. */
+#define HUGE_PGSIZE (1UL << PDPESHIFT)   /* 1 GiB. */
 
 #endif /* threads/pte.h */
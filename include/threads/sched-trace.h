@@ -0,0 +1,25 @@
+#ifndef THREADS_SCHED_TRACE_H
+#define THREADS_SCHED_TRACE_H
+
+#include <stdbool.h>
+
+/* Scheduler trace.
+
+   schedule() logs every context switch to a fixed-size ring
+   buffer, overwriting the oldest entries, and charges the time
+   the incoming thread spent on the run queue to a per-thread
+   histogram of run-queue latency.  Both cost a few stores per
+   switch, with interrupts already off, so they stay on all the
+   time; they are only printed on request. */
+
+struct thread;
+
+/* If true, sched_trace_dump() runs at power-off.
+   Controlled by kernel command-line option "-sched-trace". */
+extern bool sched_trace_at_power_off;
+
+void sched_trace_ready (struct thread *);
+void sched_trace_switch (struct thread *prev, struct thread *next);
+void sched_trace_dump (void);
+
+#endif /* threads/sched-trace.h */
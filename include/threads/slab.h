@@ -0,0 +1,40 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Slab allocator.
+
+   A kmem_cache hands out objects of one fixed size, carved out
+   of single-page "slabs" obtained from the page allocator.  Each
+   cache keeps its slabs on three lists, partial, full and empty,
+   and serves requests from a partial slab first, so that objects
+   pack into as few pages as possible.  A cache keeps one empty
+   slab around and gives any others back to the page allocator.
+
+   If a cache has a constructor, it runs once per object when a
+   slab is created, not on every allocation: objects must be
+   freed in their constructed state.
+
+   malloc() serves small requests from a set of kmem_caches too,
+   and free() accepts objects from any cache. */
+
+struct kmem_cache;
+
+/* Initializes an object of a cache. */
+typedef void kmem_ctor_func (void *obj);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+		size_t align, kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+size_t kmem_cache_size (const struct kmem_cache *);
+
+bool kmem_owns (const void *);
+struct kmem_cache *kmem_cache_of (const void *);
+size_t kmem_size (const void *);
+void kmem_free (void *);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -1,17 +1,35 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* Spinlock, for mutual exclusion between CPUs.  The holder keeps
+   interrupts off, so a spinlock also excludes interrupt handlers
+   on the holder's CPU.  Hold one only briefly, and never across
+   anything that may sleep. */
+struct spinlock {
+	int locked;                 /* Nonzero while held. */
+	enum intr_level old_level;  /* Holder's level before acquiring. */
+};
+
+void spin_lock_init (struct spinlock *);
+void spin_lock (struct spinlock *);
+void spin_unlock (struct spinlock *);
 
 /* A counting semaphore. */
 struct semaphore {
+	struct spinlock lock;       /* Protects the members below. */
 	unsigned value;             /* Current value. */
-	struct list waiters;        /* List of waiting threads. */
+	struct heap waiters;        /* Waiting threads, by priority. */
 };
 
 void sema_init (struct semaphore *, unsigned value);
 void sema_down (struct semaphore *);
+bool sema_down_timeout (struct semaphore *, int64_t ticks);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
@@ -20,24 +38,62 @@ void sema_self_test (void);
 struct lock {
 	struct thread *holder;      /* Thread holding lock (for debugging). */
 	struct semaphore semaphore; /* Binary semaphore controlling access. */
+	bool adaptive;              /* Spin while the holder runs? */
+
+	/* Priority donation. */
+	struct heap waiters;        /* Waiting threads, by priority. */
+	int max_priority;           /* Priority donated to holder, or -1. */
+	struct heap_elem elem;      /* Element in holder's held_locks. */
+
+	/* Contention statistics, updated by the holder. */
+	const char *name;           /* Name, if reported by lock_print_stats(). */
+	struct lock *next_named;    /* Next lock reported. */
+	int64_t acquires;           /* Acquisitions. */
+	int64_t contended;          /* Acquisitions that had to wait. */
+	int64_t spun;               /* Contended ones that did not block. */
+	int64_t wait_ticks;         /* Timer ticks spent waiting. */
 };
 
+/* Protects the priority donation state of all locks and threads:
+   lock waiters, holders' held locks and effective priorities. */
+extern struct spinlock donation_lock;
+
 void lock_init (struct lock *);
+void lock_init_adaptive (struct lock *);
+void lock_set_name (struct lock *, const char *name);
+void lock_print_stats (void);
 void lock_acquire (struct lock *);
+bool lock_acquire_timeout (struct lock *, int64_t ticks);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
 /* Condition variable. */
 struct condition {
-	struct list waiters;        /* List of waiting threads. */
+	struct heap waiters;        /* Waiting threads, by priority. */
 };
 
 void cond_init (struct condition *);
 void cond_wait (struct condition *, struct lock *);
+bool cond_wait_timeout (struct condition *, struct lock *, int64_t ticks);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock {
+	struct lock writer;         /* Held by the writer, active or not. */
+	unsigned readers;           /* Number of active readers. */
+	bool draining;              /* Is the writer waiting for readers? */
+	struct semaphore drained;   /* Upped by the last reader out. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_write_held_by_current_thread (const struct rwlock *);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
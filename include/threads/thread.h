@@ -2,8 +2,10 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <heap.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/interrupt.h"
 #ifdef VM
 #include "vm/vm.h"
@@ -28,6 +30,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the MLFQS. */
+#define NICE_MIN -20                    /* Nicest to others. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice to others. */
+
 /* A kernel thread or user process.
  *
  * Each thread structure is stored in its own 4 kB page.  The
@@ -80,20 +87,47 @@ typedef int tid_t;
  * set to THREAD_MAGIC.  Stack overflow will normally change this
  * value, triggering the assertion. */
 /* The `elem' member has a dual purpose.  It can be an element in
- * the run queue (thread.c), or it can be an element in a
- * semaphore wait list (synch.c).  It can be used these two ways
- * only because they are mutually exclusive: only a thread in the
- * ready state is on the run queue, whereas only a thread in the
- * blocked state is on a semaphore wait list. */
+ * the run queue (thread.c), or it can be an element in the sleep
+ * list (devices/timer.c).  It can be used these two ways only
+ * because they are mutually exclusive: only a thread in the
+ * ready state is on the run queue, whereas only a blocked thread
+ * is on the sleep list.  A thread blocked on a semaphore is kept
+ * in the semaphore's waiters through `sema_elem' instead. */
 struct thread {
 	/* Owned by thread.c. */
 	tid_t tid;                          /* Thread identifier. */
 	enum thread_status status;          /* Thread state. */
 	char name[16];                      /* Name (for debugging purposes). */
-	int priority;                       /* Priority. */
+	int priority;                       /* Effective priority. */
+	int base_priority;                  /* Priority before donation. */
+	int64_t run_ticks;                  /* Timer ticks spent running, its
+	                                       virtual time. */
 
 	/* Shared between thread.c and synch.c. */
 	struct list_elem elem;              /* List element. */
+	struct lock *wait_on_lock;          /* Lock being waited for, if any. */
+	struct heap_elem donor_elem;        /* Element in a lock's waiters. */
+	struct heap held_locks;             /* Held locks with waiters, by
+	                                       donated priority. */
+	struct semaphore *waiting_sema;     /* Semaphore being waited for,
+	                                       if any. */
+	struct heap_elem sema_elem;         /* Element in its waiters. */
+	uint64_t wait_seq;                  /* Arrival order in its waiters. */
+
+	/* Owned by threads/sched-trace.c. */
+	uint64_t ready_tsc;                 /* When put on the run queue. */
+	struct sched_hist *sched_hist;      /* Run-queue latency histogram. */
+
+	/* Owned by devices/timer.c. */
+	int64_t wakeup_tick;                /* Tick to wake up at, if sleeping. */
+
+	/* Owned by thread.c, for the MLFQS. */
+	int nice;                           /* Niceness. */
+	fixed_t recent_cpu;                 /* Recent CPU time received. */
+	bool mlfqs_active;                  /* In active_list? */
+	struct list_elem active_elem;       /* Element in active_list. */
+	bool mlfqs_dirty;                   /* In dirty_list? */
+	struct list_elem dirty_elem;        /* Element in dirty_list. */
 
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
@@ -105,6 +139,9 @@ struct thread {
 #endif
 
 	/* Owned by thread.c. */
+	struct cpu *cpu;                    /* CPU whose run queue it was
+	                                       last put on. */
+	struct thread *wakeup_next;         /* Next in a wakeup stack. */
 	struct intr_frame tf;               /* Information for switching */
 	unsigned magic;                     /* Detects stack overflow. */
 };
@@ -116,6 +153,7 @@ extern bool thread_mlfqs;
 
 void thread_init (void);
 void thread_start (void);
+void thread_init_ap (struct cpu *, void *page);
 
 void thread_tick (void);
 void thread_print_stats (void);
@@ -132,9 +170,12 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (void);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+int thread_donated_priority (const struct thread *);
+void thread_change_priority (struct thread *, int priority);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
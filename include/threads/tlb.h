@@ -0,0 +1,62 @@
+#ifndef THREADS_TLB_H
+#define THREADS_TLB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* TLB management.
+
+   When the CPU supports process-context identifiers (PCIDs),
+   each CPU tags the TLB entries of its TLB_ASIDS most recently
+   run address spaces with a PCID of their own, so switching
+   between them reloads CR3 without flushing the TLB.  The
+   kernel-only base_pml4 always uses PCID 0.  Without PCID
+   support every switch flushes the TLB, as before.
+
+   Because entries of an address space that is not running now
+   stay cached, every change that removes or weakens a mapping
+   must go through tlb_invalidate_page() or a tlb_batch, never a
+   bare invlpg. */
+
+/* Number of PCIDs each CPU hands out to user address spaces. */
+#define TLB_ASIDS 6
+
+/* Largest number of pages whose invalidation a PCID that is not
+   loaded remembers until its next use.  Beyond that, it flushes
+   all of its entries then instead. */
+#define TLB_PENDING_MAX 16
+
+/* A PCID assigned to an address space on one CPU. */
+struct tlb_asid {
+	uint64_t *pml4;             /* Owner, or NULL if free. */
+	bool stale;                 /* Flush its entries on next use? */
+	uint64_t last_used;         /* For LRU replacement. */
+	size_t pending_cnt;         /* Pages to invalidate on next use. */
+	uint64_t pending[TLB_PENDING_MAX]; /* The pages. */
+};
+
+/* Largest number of pages a tlb_batch invalidates one by one.
+   Beyond that, it flushes the whole address space instead. */
+#define TLB_BATCH_MAX 32
+
+/* Invalidations gathered while unmapping many pages of one
+   address space, to be issued together by tlb_batch_flush(). */
+struct tlb_batch {
+	uint64_t *pml4;             /* Address space. */
+	size_t cnt;                 /* Number of pages gathered. */
+	uint64_t va[TLB_BATCH_MAX]; /* The first TLB_BATCH_MAX of them. */
+};
+
+void tlb_init (void);
+bool tlb_set_pcid (bool enable);
+void tlb_activate (uint64_t *pml4);
+void tlb_invalidate_page (uint64_t *pml4, const void *va);
+void tlb_release (uint64_t *pml4);
+void tlb_print_stats (void);
+
+void tlb_batch_init (struct tlb_batch *, uint64_t *pml4);
+void tlb_batch_add (struct tlb_batch *, const void *va);
+void tlb_batch_flush (struct tlb_batch *);
+
+#endif /* threads/tlb.h */
@@ -4,10 +4,17 @@
 struct page;
 enum vm_type;
 
+/* Most pages anon_swap_out_batch() writes at once. */
+#define ANON_SWAP_BATCH 16
+
 struct anon_page {
+	size_t slot;           /* Swap slot holding the page, if evicted. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_swap_copy (struct page *page, void *kva);
+bool anon_swap_out_batch (struct page *pages[], size_t cnt);
+void vm_anon_print_stats (void);
 
 #endif
@@ -1,6 +1,9 @@
 #ifndef VM_VM_H
 #define VM_VM_H
+#include <list.h>
+#include <rbtree.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -46,6 +49,7 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	bool writable;         /* May the process write it? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -63,8 +67,25 @@ struct page {
 struct frame {
 	void *kva;
 	struct page *page;
+	uint64_t *pml4;        /* Page map that maps PAGE to KVA. */
+	struct thread *owner;  /* Thread that owns PML4. */
+	int64_t last_use;      /* OWNER's run_ticks when last seen used. */
+	bool pinned;           /* Not to be evicted? */
+	bool writeback;        /* Queued for or being written out? */
+	struct list_elem elem; /* In the frame table or the free frames. */
+	struct list_elem wb_elem; /* In the writeback queue. */
 };
 
+/* Working-set window of the WSClock eviction policy, in ticks of
+ * a process's run time, or 0 to use plain CLOCK.  Set by the
+ * "-wsclock" kernel command-line option. */
+extern int vm_ws_window;
+
+/* Slab caches for `struct page's and `struct frame's.  free()
+ * also accepts objects from them. */
+extern struct kmem_cache *page_kmem_cache;
+extern struct kmem_cache *frame_kmem_cache;
+
 /* The function table for page operations.
  * This is one way of implementing "interface" in C.
  * Put the table of "method" into the struct's member, and
@@ -82,12 +103,26 @@ struct page_operations {
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ *
+ * A radix tree keyed on the user virtual address, with the same
+ * four levels of 512 entries as the x86-64 page map, so that
+ * finding a page takes four indexed loads.  Each node is a page.
+ * Every pointer to a node is ORed with the node's number of
+ * non-empty entries, which fits in the page offset bits, and a
+ * node is freed as soon as that count drops to zero.
+ *
+ * The pages are created lazily from the areas in VMAS; see
+ * vm/vma.h. */
 struct supplemental_page_table {
+	uintptr_t root;        /* Top-level node, or 0 if empty. */
+	struct rbtree vmas;    /* Areas, as `struct vma's, by address. */
 };
 
+/* Function called by spt_for_each() on each page. */
+typedef bool spt_for_each_func (struct page *, void *aux);
+
 #include "threads/thread.h"
+#include "vm/vma.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
 		struct supplemental_page_table *src);
@@ -96,8 +131,13 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+bool spt_for_each (struct supplemental_page_table *spt, void *start,
+		void *end, spt_for_each_func *, void *aux);
+void spt_remove_range (struct supplemental_page_table *spt, void *start,
+		void *end);
 
 void vm_init (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -0,0 +1,47 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <rbtree.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+struct file;
+struct page;
+struct supplemental_page_table;
+
+/* Marks the stack's area and the pages in it. */
+#define VM_STACK VM_MARKER_0
+
+/* A virtual memory area: a range of pages in a process's address
+ * space with the same backing and permissions, such as an
+ * executable's segment, a mmap()ed file, or the stack.
+ *
+ * Areas are kept in a red-black tree ordered by address, and
+ * never overlap.  The `struct page's of an area are created one
+ * at a time, when each is first touched, so the cost of creating
+ * an area does not depend on its size. */
+struct vma {
+	struct rb_elem elem;        /* In supplemental_page_table's vmas. */
+	void *start;                /* First page. */
+	void *end;                  /* One past the last page. */
+	enum vm_type type;          /* Type of its pages. */
+	bool writable;              /* May the process write it? */
+	struct file *file;          /* Backing file, or NULL. */
+	off_t offset;               /* Offset in FILE of START. */
+	size_t read_bytes;          /* Bytes read from FILE; the rest are 0. */
+};
+
+void vm_vma_init (void);
+void vma_init (struct supplemental_page_table *);
+struct vma *vma_insert (struct supplemental_page_table *, void *start,
+		void *end, enum vm_type, bool writable, struct file *,
+		off_t offset, size_t read_bytes);
+struct vma *vma_find (struct supplemental_page_table *, const void *addr);
+bool vma_overlaps (struct supplemental_page_table *, const void *start,
+		const void *end);
+void vma_remove (struct supplemental_page_table *, struct vma *);
+void vma_remove_all (struct supplemental_page_table *);
+struct page *vma_fault (struct supplemental_page_table *, void *addr);
+
+#endif /* vm/vma.h */
@@ -0,0 +1,170 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* A pairing heap is a heap-ordered tree in which each node
+   keeps a singly ordered list of children: `child' points to a
+   node's leftmost child and `next' to its right sibling.  `prev'
+   points back to the left sibling, or to the parent for a
+   leftmost child, so that any node can be unlinked in constant
+   time.
+
+   Two trees are melded by making the smaller root the leftmost
+   child of the larger one.  Removing a root melds its children
+   in two passes: first pairwise from left to right, then the
+   results from right to left, which gives the amortized
+   O(log n) bound. */
+
+static struct heap_elem *meld (struct heap *,
+		struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+
+/* Initializes HEAP as an empty heap ordered by LESS given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *heap, heap_less_func *less, void *aux) {
+	ASSERT (heap != NULL);
+	ASSERT (less != NULL);
+
+	heap->root = NULL;
+	heap->size = 0;
+	heap->less = less;
+	heap->aux = aux;
+}
+
+/* Inserts ELEM into HEAP. */
+void
+heap_push (struct heap *heap, struct heap_elem *elem) {
+	ASSERT (heap != NULL);
+	ASSERT (elem != NULL);
+
+	elem->child = elem->next = elem->prev = NULL;
+	heap->root = meld (heap, heap->root, elem);
+	heap->size++;
+}
+
+/* Removes the maximum element from HEAP and returns it.
+   Undefined behavior if HEAP is empty. */
+struct heap_elem *
+heap_pop (struct heap *heap) {
+	struct heap_elem *top = heap_top (heap);
+
+	heap_remove (heap, top);
+	return top;
+}
+
+/* Removes ELEM, which must be in HEAP, from HEAP. */
+void
+heap_remove (struct heap *heap, struct heap_elem *elem) {
+	struct heap_elem *subtree;
+
+	ASSERT (heap != NULL);
+	ASSERT (elem != NULL);
+	ASSERT (heap->size > 0);
+
+	if (elem != heap->root) {
+		/* Unlink ELEM and its subtree from its parent. */
+		if (elem->prev->child == elem)
+			elem->prev->child = elem->next;
+		else
+			elem->prev->next = elem->next;
+		if (elem->next != NULL)
+			elem->next->prev = elem->prev;
+
+		subtree = merge_pairs (heap, elem->child);
+		heap->root = meld (heap, heap->root, subtree);
+	} else
+		heap->root = merge_pairs (heap, elem->child);
+
+	elem->child = elem->next = elem->prev = NULL;
+	heap->size--;
+}
+
+/* Returns the maximum element in HEAP.
+   Undefined behavior if HEAP is empty. */
+struct heap_elem *
+heap_top (const struct heap *heap) {
+	ASSERT (heap != NULL);
+	ASSERT (heap->root != NULL);
+
+	return heap->root;
+}
+
+/* Returns the number of elements in HEAP. */
+size_t
+heap_size (const struct heap *heap) {
+	ASSERT (heap != NULL);
+
+	return heap->size;
+}
+
+/* Returns true if HEAP is empty, false otherwise. */
+bool
+heap_empty (const struct heap *heap) {
+	ASSERT (heap != NULL);
+
+	return heap->root == NULL;
+}
+
+/* Melds the trees rooted at A and B, either of which may be
+   null, and returns the root of the result.  A and B must not
+   have siblings. */
+static struct heap_elem *
+meld (struct heap *heap, struct heap_elem *a, struct heap_elem *b) {
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+
+	if (heap->less (a, b, heap->aux)) {
+		struct heap_elem *tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	/* Make B the leftmost child of A. */
+	b->next = a->child;
+	if (a->child != NULL)
+		a->child->prev = b;
+	b->prev = a;
+	a->child = b;
+	return a;
+}
+
+/* Melds the list of sibling trees starting at FIRST into a
+   single tree and returns its root, or a null pointer if FIRST
+   is null. */
+static struct heap_elem *
+merge_pairs (struct heap *heap, struct heap_elem *first) {
+	struct heap_elem *pairs = NULL;
+	struct heap_elem *result = NULL;
+
+	/* First pass: meld pairs from left to right, stacking the
+	   results on PAIRS through their `next' members. */
+	while (first != NULL) {
+		struct heap_elem *a = first;
+		struct heap_elem *b = a->next;
+		struct heap_elem *m;
+
+		first = b != NULL ? b->next : NULL;
+		a->next = a->prev = NULL;
+		if (b != NULL)
+			b->next = b->prev = NULL;
+
+		m = meld (heap, a, b);
+		m->next = pairs;
+		pairs = m;
+	}
+
+	/* Second pass: meld the pairs from right to left. */
+	while (pairs != NULL) {
+		struct heap_elem *p = pairs;
+
+		pairs = p->next;
+		p->next = NULL;
+		result = meld (heap, result, p);
+	}
+
+	if (result != NULL)
+		result->prev = NULL;
+	return result;
+}
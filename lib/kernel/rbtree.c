@@ -0,0 +1,369 @@
+#include "rbtree.h"
+#include "../debug.h"
+
+/* A red-black tree keeps these invariants, which bound its
+   height by 2 log (n + 1):
+
+   - The root is black.
+   - A red element has no red child.
+   - Every path from an element down to a missing (NULL) child
+     passes through the same number of black elements.
+
+   Missing children count as black.  Insertion and removal
+   restore the invariants with recoloring and at most three
+   rotations, as described in Cormen et al., "Introduction to
+   Algorithms", chapter 13. */
+
+static void rotate_left (struct rbtree *, struct rb_elem *);
+static void rotate_right (struct rbtree *, struct rb_elem *);
+static void insert_fixup (struct rbtree *, struct rb_elem *);
+static void remove_fixup (struct rbtree *, struct rb_elem *,
+		struct rb_elem *parent);
+
+/* Returns true if E is a red element, false if it is black or
+   missing. */
+static inline bool
+is_red (const struct rb_elem *e) {
+	return e != NULL && e->red;
+}
+
+/* Initializes TREE as an empty tree ordered by LESS given
+   auxiliary data AUX. */
+void
+rb_init (struct rbtree *tree, rb_less_func *less, void *aux) {
+	ASSERT (tree != NULL);
+	ASSERT (less != NULL);
+
+	tree->root = NULL;
+	tree->size = 0;
+	tree->less = less;
+	tree->aux = aux;
+}
+
+/* Inserts ELEM into TREE, unless TREE already contains an
+   element equal to ELEM.  Returns that element if so, a null
+   pointer otherwise. */
+struct rb_elem *
+rb_insert (struct rbtree *tree, struct rb_elem *elem) {
+	struct rb_elem **link = &tree->root;
+	struct rb_elem *parent = NULL;
+
+	ASSERT (tree != NULL);
+	ASSERT (elem != NULL);
+
+	while (*link != NULL) {
+		parent = *link;
+		if (tree->less (elem, parent, tree->aux))
+			link = &parent->left;
+		else if (tree->less (parent, elem, tree->aux))
+			link = &parent->right;
+		else
+			return parent;
+	}
+
+	elem->parent = parent;
+	elem->left = elem->right = NULL;
+	elem->red = true;
+	*link = elem;
+	tree->size++;
+	insert_fixup (tree, elem);
+	return NULL;
+}
+
+/* Replaces OLD, a child of its parent or TREE's root, by NEW. */
+static void
+replace_child (struct rbtree *tree, struct rb_elem *old,
+		struct rb_elem *new) {
+	struct rb_elem *parent = old->parent;
+
+	if (parent == NULL)
+		tree->root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+	if (new != NULL)
+		new->parent = parent;
+}
+
+/* Removes ELEM, which must be in TREE, from TREE. */
+void
+rb_remove (struct rbtree *tree, struct rb_elem *elem) {
+	struct rb_elem *child, *parent;
+	bool removed_red;
+
+	ASSERT (tree != NULL);
+	ASSERT (elem != NULL);
+	ASSERT (tree->size > 0);
+
+	if (elem->left == NULL || elem->right == NULL) {
+		/* ELEM has at most one child, which takes its place. */
+		child = elem->left != NULL ? elem->left : elem->right;
+		parent = elem->parent;
+		removed_red = elem->red;
+		replace_child (tree, elem, child);
+	} else {
+		/* Move ELEM's successor, which has no left child, into
+		   ELEM's place, so that the element really taken out of
+		   the tree is at the successor's old position. */
+		struct rb_elem *next = elem->right;
+
+		while (next->left != NULL)
+			next = next->left;
+		child = next->right;
+		removed_red = next->red;
+		if (next->parent == elem)
+			parent = next;
+		else {
+			parent = next->parent;
+			replace_child (tree, next, child);
+			next->right = elem->right;
+			next->right->parent = next;
+		}
+		replace_child (tree, elem, next);
+		next->left = elem->left;
+		next->left->parent = next;
+		next->red = elem->red;
+	}
+	tree->size--;
+
+	if (!removed_red)
+		remove_fixup (tree, child, parent);
+}
+
+/* Returns the element in TREE equal to KEY, or a null pointer
+   if there is none. */
+struct rb_elem *
+rb_find (const struct rbtree *tree, const struct rb_elem *key) {
+	struct rb_elem *e = rb_floor (tree, key);
+
+	return e != NULL && !tree->less (e, key, tree->aux) ? e : NULL;
+}
+
+/* Returns the greatest element in TREE that is less than or
+   equal to KEY, or a null pointer if every element is greater
+   than KEY. */
+struct rb_elem *
+rb_floor (const struct rbtree *tree, const struct rb_elem *key) {
+	struct rb_elem *e = tree->root;
+	struct rb_elem *floor = NULL;
+
+	while (e != NULL) {
+		if (tree->less (key, e, tree->aux))
+			e = e->left;
+		else {
+			floor = e;
+			e = e->right;
+		}
+	}
+	return floor;
+}
+
+/* Returns the least element in TREE, or a null pointer if TREE
+   is empty. */
+struct rb_elem *
+rb_first (const struct rbtree *tree) {
+	struct rb_elem *e = tree->root;
+
+	if (e != NULL)
+		while (e->left != NULL)
+			e = e->left;
+	return e;
+}
+
+/* Returns the greatest element in TREE, or a null pointer if
+   TREE is empty. */
+struct rb_elem *
+rb_last (const struct rbtree *tree) {
+	struct rb_elem *e = tree->root;
+
+	if (e != NULL)
+		while (e->right != NULL)
+			e = e->right;
+	return e;
+}
+
+/* Returns the element that follows ELEM in its tree, or a null
+   pointer if ELEM is the greatest. */
+struct rb_elem *
+rb_next (const struct rb_elem *elem) {
+	const struct rb_elem *e;
+
+	if (elem->right != NULL) {
+		e = elem->right;
+		while (e->left != NULL)
+			e = e->left;
+		return (struct rb_elem *) e;
+	}
+	for (e = elem; e->parent != NULL && e->parent->right == e;
+			e = e->parent)
+		continue;
+	return e->parent;
+}
+
+/* Returns the element that precedes ELEM in its tree, or a null
+   pointer if ELEM is the least. */
+struct rb_elem *
+rb_prev (const struct rb_elem *elem) {
+	const struct rb_elem *e;
+
+	if (elem->left != NULL) {
+		e = elem->left;
+		while (e->right != NULL)
+			e = e->right;
+		return (struct rb_elem *) e;
+	}
+	for (e = elem; e->parent != NULL && e->parent->left == e;
+			e = e->parent)
+		continue;
+	return e->parent;
+}
+
+/* Returns the number of elements in TREE. */
+size_t
+rb_size (const struct rbtree *tree) {
+	return tree->size;
+}
+
+/* Returns true if TREE is empty, false otherwise. */
+bool
+rb_empty (const struct rbtree *tree) {
+	return tree->root == NULL;
+}
+
+/* Makes E's right child take E's place, with E as its left
+   child. */
+static void
+rotate_left (struct rbtree *tree, struct rb_elem *e) {
+	struct rb_elem *r = e->right;
+
+	e->right = r->left;
+	if (r->left != NULL)
+		r->left->parent = e;
+	replace_child (tree, e, r);
+	r->left = e;
+	e->parent = r;
+}
+
+/* Makes E's left child take E's place, with E as its right
+   child. */
+static void
+rotate_right (struct rbtree *tree, struct rb_elem *e) {
+	struct rb_elem *l = e->left;
+
+	e->left = l->right;
+	if (l->right != NULL)
+		l->right->parent = e;
+	replace_child (tree, e, l);
+	l->right = e;
+	e->parent = l;
+}
+
+/* Restores the invariants after inserting red element E. */
+static void
+insert_fixup (struct rbtree *tree, struct rb_elem *e) {
+	while (is_red (e->parent)) {
+		struct rb_elem *parent = e->parent;
+		struct rb_elem *grand = parent->parent;
+
+		if (parent == grand->left) {
+			struct rb_elem *uncle = grand->right;
+
+			if (is_red (uncle)) {
+				parent->red = uncle->red = false;
+				grand->red = true;
+				e = grand;
+				continue;
+			}
+			if (e == parent->right) {
+				rotate_left (tree, parent);
+				e = parent;
+				parent = e->parent;
+			}
+			parent->red = false;
+			grand->red = true;
+			rotate_right (tree, grand);
+		} else {
+			struct rb_elem *uncle = grand->left;
+
+			if (is_red (uncle)) {
+				parent->red = uncle->red = false;
+				grand->red = true;
+				e = grand;
+				continue;
+			}
+			if (e == parent->left) {
+				rotate_right (tree, parent);
+				e = parent;
+				parent = e->parent;
+			}
+			parent->red = false;
+			grand->red = true;
+			rotate_left (tree, grand);
+		}
+	}
+	tree->root->red = false;
+}
+
+/* Restores the invariants after removing a black element, whose
+   place was taken by E, possibly null, a child of PARENT. */
+static void
+remove_fixup (struct rbtree *tree, struct rb_elem *e,
+		struct rb_elem *parent) {
+	while (e != tree->root && !is_red (e)) {
+		if (e == parent->left) {
+			struct rb_elem *sib = parent->right;
+
+			if (is_red (sib)) {
+				sib->red = false;
+				parent->red = true;
+				rotate_left (tree, parent);
+				sib = parent->right;
+			}
+			if (!is_red (sib->left) && !is_red (sib->right)) {
+				sib->red = true;
+				e = parent;
+				parent = e->parent;
+				continue;
+			}
+			if (!is_red (sib->right)) {
+				sib->left->red = false;
+				sib->red = true;
+				rotate_right (tree, sib);
+				sib = parent->right;
+			}
+			sib->red = parent->red;
+			parent->red = false;
+			sib->right->red = false;
+			rotate_left (tree, parent);
+		} else {
+			struct rb_elem *sib = parent->left;
+
+			if (is_red (sib)) {
+				sib->red = false;
+				parent->red = true;
+				rotate_right (tree, parent);
+				sib = parent->left;
+			}
+			if (!is_red (sib->left) && !is_red (sib->right)) {
+				sib->red = true;
+				e = parent;
+				parent = e->parent;
+				continue;
+			}
+			if (!is_red (sib->left)) {
+				sib->right->red = false;
+				sib->red = true;
+				rotate_left (tree, sib);
+				sib = parent->left;
+			}
+			sib->red = parent->red;
+			parent->red = false;
+			sib->left->red = false;
+			rotate_right (tree, parent);
+		}
+		e = tree->root;
+	}
+	if (e != NULL)
+		e->red = false;
+}
@@ -194,3 +194,8 @@ int
 umount (const char *path) {
 	return syscall1 (SYS_UMOUNT, path);
 }
+
+void
+sched_trace (void) {
+	syscall0 (SYS_SCHED_TRACE);
+}
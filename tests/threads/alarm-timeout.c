@@ -0,0 +1,135 @@
+/* Arms 10,000 timeouts at once on the timer wheel, cancels a
+   quarter of them, and verifies that every other one fires
+   exactly at its expiry tick.  Then checks that
+   sema_down_timeout() both times out and succeeds as it
+   should. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timeout.h"
+#include "devices/timer.h"
+
+#define TIMEOUT_CNT 10000
+#define MAX_DELAY 1100
+
+/* One armed timeout and when it fired. */
+struct timeout_test 
+  {
+    struct timeout timeout;     /* The timeout. */
+    int64_t expires;            /* Tick it should fire at. */
+    int64_t fired;              /* Tick it fired at, or 0. */
+  };
+
+static timeout_func record_fire;
+static thread_func up_thread;
+static void test_sema_timeout (void);
+
+void
+test_alarm_timeout (void) 
+{
+  struct timeout_test *tests;
+  enum intr_level old_level;
+  int64_t start;
+  int fired_cnt = 0, cancelled_cnt = 0;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  tests = malloc (sizeof *tests * TIMEOUT_CNT);
+  if (tests == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  msg ("Arming %d timeouts over %d ticks.", TIMEOUT_CNT, MAX_DELAY);
+
+  /* Arm and cancel with interrupts off, so that no timeout can
+     fire before we are done and the result is deterministic. */
+  old_level = intr_disable ();
+  start = timer_ticks ();
+  for (i = 0; i < TIMEOUT_CNT; i++) 
+    {
+      struct timeout_test *t = &tests[i];
+      int64_t delay = (int64_t) i * 37 % MAX_DELAY + 1;
+
+      t->fired = 0;
+      timeout_init (&t->timeout, record_fire, t);
+      timeout_add (&t->timeout, delay);
+      t->expires = t->timeout.expires;
+    }
+
+  for (i = 0; i < TIMEOUT_CNT; i += 4)
+    if (timeout_cancel (&tests[i].timeout))
+      cancelled_cnt++;
+  intr_set_level (old_level);
+  msg ("Cancelled %d timeouts.", cancelled_cnt);
+
+  timer_sleep (MAX_DELAY + 10 - timer_elapsed (start));
+
+  for (i = 0; i < TIMEOUT_CNT; i++) 
+    {
+      struct timeout_test *t = &tests[i];
+
+      if (timeout_pending (&t->timeout))
+        fail ("timeout %d still pending at tick %lld", i, timer_ticks ());
+      if (i % 4 == 0) 
+        {
+          if (t->fired != 0)
+            fail ("cancelled timeout %d fired", i);
+          continue;
+        }
+      if (t->fired != t->expires)
+        fail ("timeout %d fired at tick %lld instead of %lld",
+              i, t->fired, t->expires);
+      fired_cnt++;
+    }
+  msg ("%d timeouts fired on time.", fired_cnt);
+  free (tests);
+
+  test_sema_timeout ();
+}
+
+/* Checks both outcomes of sema_down_timeout(). */
+static void
+test_sema_timeout (void) 
+{
+  struct semaphore sema;
+  int64_t start;
+
+  sema_init (&sema, 0);
+  start = timer_ticks ();
+  if (sema_down_timeout (&sema, 10))
+    fail ("sema_down_timeout succeeded on a semaphore nobody upped");
+  if (timer_elapsed (start) < 10)
+    fail ("sema_down_timeout gave up after only %lld ticks",
+          timer_elapsed (start));
+  msg ("sema_down_timeout timed out.");
+
+  thread_create ("up", PRI_DEFAULT, up_thread, &sema);
+  if (!sema_down_timeout (&sema, 1000))
+    fail ("sema_down_timeout timed out although the semaphore was upped");
+  msg ("sema_down_timeout succeeded.");
+}
+
+/* Records the tick at which the timeout in T_ fired. */
+static void
+record_fire (void *t_) 
+{
+  struct timeout_test *t = t_;
+
+  t->fired = timer_ticks ();
+}
+
+/* Ups SEMA_ after a short sleep. */
+static void
+up_thread (void *sema_) 
+{
+  struct semaphore *sema = sema_;
+
+  timer_sleep (5);
+  sema_up (sema);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-timeout) begin
+(alarm-timeout) Arming 10000 timeouts over 1100 ticks.
+(alarm-timeout) Cancelled 2500 timeouts.
+(alarm-timeout) 7500 timeouts fired on time.
+(alarm-timeout) sema_down_timeout timed out.
+(alarm-timeout) sema_down_timeout succeeded.
+(alarm-timeout) end
+EOF
+pass;
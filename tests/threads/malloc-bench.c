@@ -0,0 +1,138 @@
+/* Measures malloc() and free() throughput with 1, 2, 4 and 8
+   kernel threads, each of which allocates and frees blocks of
+   random small sizes for TEST_TICKS timer ticks, and reports the
+   total number of operations per second.  Also checks that every
+   block holds what was written to it. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define TEST_TICKS 50
+#define THREAD_MAX 8
+#define SLOT_CNT 32
+#define BLOCK_MAX 512
+
+/* Information about the test. */
+struct bench_test 
+  {
+    int64_t start;              /* Current time at start of run. */
+    int64_t ops[THREAD_MAX];    /* Operations done per thread. */
+    bool ok[THREAD_MAX];        /* False if a thread saw corruption. */
+    struct semaphore done;      /* Upped by each thread when done. */
+  };
+
+/* Information about an individual thread. */
+struct bench_thread 
+  {
+    struct bench_test *test;
+    int idx;
+  };
+
+static int64_t run (int thread_cnt);
+static thread_func bench_thread;
+
+void
+test_malloc_bench (void) 
+{
+  int thread_cnt;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  for (thread_cnt = 1; thread_cnt <= THREAD_MAX; thread_cnt *= 2) 
+    {
+      int64_t ops = run (thread_cnt);
+
+      if (ops == 0)
+        fail ("%d threads did no work", thread_cnt);
+      msg ("%d threads: %lld ops/s",
+           thread_cnt, ops * TIMER_FREQ / TEST_TICKS);
+    }
+}
+
+/* Runs THREAD_CNT threads for TEST_TICKS and returns the total
+   number of malloc() and free() calls they made. */
+static int64_t
+run (int thread_cnt) 
+{
+  static struct bench_test test;
+  static struct bench_thread threads[THREAD_MAX];
+  int64_t ops = 0;
+  int i;
+
+  sema_init (&test.done, 0);
+
+  /* Stay above the threads until all have been created, so they
+     start together. */
+  thread_set_priority (PRI_DEFAULT + 1);
+  test.start = timer_ticks ();
+  for (i = 0; i < thread_cnt; i++) 
+    {
+      char name[16];
+
+      threads[i].test = &test;
+      threads[i].idx = i;
+      test.ops[i] = 0;
+      test.ok[i] = true;
+      snprintf (name, sizeof name, "malloc %d", i);
+      thread_create (name, PRI_DEFAULT, bench_thread, &threads[i]);
+    }
+  thread_set_priority (PRI_DEFAULT);
+
+  for (i = 0; i < thread_cnt; i++) 
+    sema_down (&test.done);
+  for (i = 0; i < thread_cnt; i++) 
+    {
+      if (!test.ok[i])
+        fail ("thread %d found a corrupted block", i);
+      ops += test.ops[i];
+    }
+  return ops;
+}
+
+static void
+bench_thread (void *t_) 
+{
+  struct bench_thread *t = t_;
+  struct bench_test *test = t->test;
+  unsigned char *slots[SLOT_CNT];
+  unsigned seed = t->idx * 2654435761u + 1;
+  int64_t ops = 0;
+  int i;
+
+  for (i = 0; i < SLOT_CNT; i++)
+    slots[i] = NULL;
+
+  while (timer_elapsed (test->start) < TEST_TICKS) 
+    {
+      unsigned char **slot;
+
+      seed = seed * 1103515245 + 12345;
+      slot = &slots[(seed >> 16) % SLOT_CNT];
+      if (*slot != NULL) 
+        {
+          if (**slot != (unsigned char) (slot - slots))
+            test->ok[t->idx] = false;
+          free (*slot);
+          *slot = NULL;
+        }
+      else 
+        {
+          *slot = malloc (1 + (seed >> 8) % BLOCK_MAX);
+          if (*slot == NULL)
+            fail ("out of memory");
+          **slot = slot - slots;
+        }
+      ops++;
+    }
+
+  for (i = 0; i < SLOT_CNT; i++)
+    free (slots[i]);
+  test->ops[t->idx] = ops;
+  sema_up (&test->done);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+foreach my $threads (1, 2, 4, 8) {
+    fail "Throughput of $threads threads not reported.\n"
+      if !grep (/^\(malloc-bench\) $threads threads: \d+ ops\/s$/, @output);
+}
+pass;
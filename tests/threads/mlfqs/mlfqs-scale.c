@@ -0,0 +1,86 @@
+/* Starts 500 threads that alternate between spinning and
+   sleeping under the MLFQS, and reports how long the timer
+   interrupt handler takes while they run.
+
+   Only the threads that ran recently need their priority
+   recomputed, so the average cost per timer interrupt should
+   stay low even though hundreds of threads exist.  The
+   once-a-second recent_cpu decay shows up in the maximum. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 500
+#define RUN_SECONDS 10
+
+struct scale_info 
+  {
+    int64_t deadline;           /* Tick at which threads stop. */
+    struct semaphore done;      /* Upped by each thread on exit. */
+  };
+
+static thread_func scale_thread;
+
+void
+test_mlfqs_scale (void) 
+{
+  struct scale_info info;
+  struct timer_handler_stats before, after;
+  int64_t interrupts;
+  int i;
+
+  ASSERT (thread_mlfqs);
+
+  /* Stay ahead of the load threads. */
+  thread_set_nice (-20);
+
+  info.deadline = timer_ticks () + RUN_SECONDS * TIMER_FREQ;
+  sema_init (&info.done, 0);
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "load %d", i);
+      if (thread_create (name, PRI_DEFAULT, scale_thread, &info) == TID_ERROR)
+        fail ("creating thread %d failed", i);
+    }
+  msg ("Started %d threads, running for %d seconds.",
+       THREAD_CNT, RUN_SECONDS);
+
+  timer_get_handler_stats (&before);
+  timer_sleep (info.deadline - timer_ticks ());
+  timer_get_handler_stats (&after);
+
+  interrupts = after.interrupts - before.interrupts;
+  if (interrupts <= 0)
+    fail ("no timer interrupts while the threads ran");
+  msg ("timer interrupt: %"PRIu64" cycles on average over %"PRId64
+       " interrupts, %"PRIu64" cycles at most",
+       (after.cycles - before.cycles) / interrupts, interrupts,
+       after.max_cycles);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&info.done);
+  msg ("All threads finished.");
+}
+
+static void
+scale_thread (void *info_) 
+{
+  struct scale_info *info = info_;
+
+  thread_set_nice (0);
+  while (timer_ticks () < info->deadline) 
+    {
+      int64_t spin_until = timer_ticks () + 2;
+
+      while (timer_ticks () < spin_until)
+        continue;
+      timer_sleep (10);
+    }
+  sema_up (&info->done);
+}
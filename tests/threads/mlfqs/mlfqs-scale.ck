@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "Threads were not all started.\n"
+  if !grep (/^\(mlfqs-scale\) Started 500 threads/, @output);
+fail "Timer interrupt handler time not reported.\n"
+  if !grep (/^\(mlfqs-scale\) timer interrupt: \d+ cycles on average/, @output);
+fail "Threads did not all finish.\n"
+  if !grep (/^\(mlfqs-scale\) All threads finished\.$/, @output);
+pass;
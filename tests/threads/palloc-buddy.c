@@ -0,0 +1,55 @@
+/* Measures the page allocator under churn: keeps SLOTS blocks of
+   1 to MAX_PAGES pages allocated from the user pool, replacing a
+   random one each round, and reports the average cycles spent
+   per palloc_get_multiple() and palloc_free_multiple() call,
+   then the fragmentation left behind. */
+
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "intrinsic.h"
+
+#define SLOTS 1024
+#define MAX_PAGES 16
+#define ROUNDS 20000
+
+static void *pages[SLOTS];
+static size_t page_cnts[SLOTS];
+
+void
+test_palloc_buddy (void) 
+{
+  uint64_t get_cycles = 0, free_cycles = 0, start;
+  int gets = 0, frees = 0, failures = 0;
+  int round, i;
+
+  random_init (0);
+  for (round = 0; round < SLOTS + ROUNDS; round++) 
+    {
+      i = round < SLOTS ? round : (int) (random_ulong () % SLOTS);
+      if (pages[i] != NULL) 
+        {
+          start = rdtsc ();
+          palloc_free_multiple (pages[i], page_cnts[i]);
+          free_cycles += rdtsc () - start;
+          frees++;
+        }
+
+      page_cnts[i] = random_ulong () % MAX_PAGES + 1;
+      start = rdtsc ();
+      pages[i] = palloc_get_multiple (PAL_USER, page_cnts[i]);
+      get_cycles += rdtsc () - start;
+      gets++;
+      if (pages[i] == NULL)
+        failures++;
+    }
+
+  msg ("%d gets: %llu cycles each, %d failed", gets, get_cycles / gets,
+       failures);
+  msg ("%d frees: %llu cycles each", frees, free_cycles / frees);
+  palloc_print_stats ();
+
+  for (i = 0; i < SLOTS; i++)
+    palloc_free_multiple (pages[i], page_cnts[i]);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "No allocation cost reported.\n"
+  if !grep (/^\(palloc-buddy\) \d+ gets: \d+ cycles each, 0 failed$/, @output);
+fail "No free cost reported.\n"
+  if !grep (/^\(palloc-buddy\) \d+ frees: \d+ cycles each$/, @output);
+fail "No fragmentation reported.\n"
+  if !grep (/^user pool: \d+ of \d+ pages free in \d+ blocks, largest \d+ pages$/,
+	    @output);
+pass;
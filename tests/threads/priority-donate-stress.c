@@ -0,0 +1,122 @@
+/* Runs 64 threads of different priorities that repeatedly take
+   a chain of 8 nested locks, so that donations nest up to the
+   full donation depth, and reports the average cost of
+   lock_acquire() and lock_release() under that contention.
+
+   Checks at the end that every lock is free again and that no
+   donated priority has been left behind. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "intrinsic.h"
+
+#define THREAD_CNT 64
+#define LOCK_CNT 8
+#define ITER_CNT 100
+
+/* Per-thread state. */
+struct stress_thread 
+  {
+    struct lock *locks;         /* The lock chain. */
+    struct semaphore *done;     /* Upped when the thread finishes. */
+    int first;                  /* First lock in the chain to take. */
+    uint64_t acquire_cycles;    /* Cycles spent in lock_acquire(). */
+    uint64_t release_cycles;    /* Cycles spent in lock_release(). */
+    int64_t acquire_cnt;        /* Number of lock_acquire() calls. */
+  };
+
+static thread_func stress_thread;
+
+void
+test_priority_donate_stress (void) 
+{
+  static struct stress_thread threads[THREAD_CNT];
+  struct lock locks[LOCK_CNT];
+  struct semaphore done;
+  uint64_t acquire_cycles = 0, release_cycles = 0;
+  int64_t acquire_cnt = 0;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  for (i = 0; i < LOCK_CNT; i++)
+    lock_init (&locks[i]);
+  sema_init (&done, 0);
+
+  /* Stay above every thread until they have all been created. */
+  thread_set_priority (PRI_MAX);
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      struct stress_thread *t = &threads[i];
+      char name[16];
+
+      t->locks = locks;
+      t->done = &done;
+      t->first = i % LOCK_CNT;
+      t->acquire_cycles = t->release_cycles = 0;
+      t->acquire_cnt = 0;
+      snprintf (name, sizeof name, "stress %d", i);
+      thread_create (name, PRI_MIN + 1 + i * (PRI_MAX - PRI_MIN - 2) / THREAD_CNT,
+                     stress_thread, t);
+    }
+
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  msg ("%d threads finished %d iterations over %d locks.",
+       THREAD_CNT, ITER_CNT, LOCK_CNT);
+
+  for (i = 0; i < LOCK_CNT; i++)
+    if (locks[i].holder != NULL)
+      fail ("lock %d is still held", i);
+  if (thread_get_priority () != PRI_MAX)
+    fail ("main thread has priority %d instead of %d",
+          thread_get_priority (), PRI_MAX);
+  thread_set_priority (PRI_DEFAULT);
+  msg ("All locks are free and no donation is left.");
+
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      acquire_cycles += threads[i].acquire_cycles;
+      release_cycles += threads[i].release_cycles;
+      acquire_cnt += threads[i].acquire_cnt;
+    }
+  msg ("lock_acquire: %"PRIu64" cycles, lock_release: %"PRIu64
+       " cycles on average over %"PRId64" calls",
+       acquire_cycles / acquire_cnt, release_cycles / acquire_cnt,
+       acquire_cnt);
+}
+
+static void
+stress_thread (void *t_) 
+{
+  struct stress_thread *t = t_;
+  int i, j;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      /* Always take the locks in increasing order, to avoid
+         deadlock. */
+      for (j = t->first; j < LOCK_CNT; j++) 
+        {
+          uint64_t start = rdtsc ();
+          lock_acquire (&t->locks[j]);
+          t->acquire_cycles += rdtsc () - start;
+          t->acquire_cnt++;
+        }
+      for (j = LOCK_CNT - 1; j >= t->first; j--) 
+        {
+          uint64_t start = rdtsc ();
+          lock_release (&t->locks[j]);
+          t->release_cycles += rdtsc () - start;
+        }
+    }
+  sema_up (t->done);
+}
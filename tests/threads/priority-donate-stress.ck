@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "Threads did not all finish.\n"
+  if !grep (/^\(priority-donate-stress\) 64 threads finished 100 iterations over 8 locks\.$/, @output);
+fail "Locks or donations were left behind.\n"
+  if !grep (/^\(priority-donate-stress\) All locks are free and no donation is left\.$/, @output);
+fail "Lock acquire/release cost not reported.\n"
+  if !grep (/^\(priority-donate-stress\) lock_acquire: \d+ cycles, lock_release: \d+ cycles/, @output);
+pass;
@@ -0,0 +1,127 @@
+/* Blocks 1000 threads of mixed priorities on one semaphore and
+   checks that sema_up() wakes them highest priority first, and in
+   the order they started waiting among equal priorities.  Then
+   blocks 1000 fresh waiters and reports the average cost of
+   sema_up() while they are all queued. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "intrinsic.h"
+
+#define WAITER_CNT 1000
+
+/* Priority of waiter I.  Spreads the waiters over every priority
+   between PRI_MIN and PRI_MAX, exclusive, with many of each. */
+#define WAITER_PRIORITY(I) (PRI_MIN + 1 + (I) * 7 % (PRI_MAX - PRI_MIN - 1))
+
+/* Shared state. */
+struct waiters 
+  {
+    struct semaphore sema;      /* What the waiters wait on. */
+    struct semaphore done;      /* Upped by each waiter when woken. */
+    int order[WAITER_CNT];      /* Waiter indexes in wake-up order. */
+    int woken_cnt;              /* Number of waiters woken so far. */
+  };
+
+/* One waiter. */
+struct waiter 
+  {
+    struct waiters *shared;
+    int idx;
+  };
+
+static void create_waiters (struct waiters *, struct waiter[]);
+static thread_func waiter_thread;
+
+void
+test_priority_sema_waiters (void) 
+{
+  static struct waiters shared;
+  static struct waiter waiters[WAITER_CNT];
+  uint64_t start, cycles;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  /* Wake the waiters one by one from below all of them, so that
+     each runs as soon as it is woken and records its turn. */
+  create_waiters (&shared, waiters);
+  for (i = 0; i < WAITER_CNT; i++)
+    sema_up (&shared.sema);
+  if (shared.woken_cnt != WAITER_CNT)
+    fail ("only %d of %d waiters woke up", shared.woken_cnt, WAITER_CNT);
+
+  for (i = 1; i < WAITER_CNT; i++) 
+    {
+      int prev = shared.order[i - 1], cur = shared.order[i];
+      int prev_pri = WAITER_PRIORITY (prev), cur_pri = WAITER_PRIORITY (cur);
+
+      if (cur_pri > prev_pri)
+        fail ("waiter %d (priority %d) woke after waiter %d (priority %d)",
+              cur, cur_pri, prev, prev_pri);
+      if (cur_pri == prev_pri && cur < prev)
+        fail ("waiter %d woke after later waiter %d of equal priority",
+              cur, prev);
+    }
+  msg ("%d waiters woke in priority order, FIFO among equals.",
+       WAITER_CNT);
+
+  /* Wake a fresh set of waiters from above all of them, so that
+     only sema_up() itself is timed. */
+  create_waiters (&shared, waiters);
+  thread_set_priority (PRI_MAX);
+  start = rdtsc ();
+  for (i = 0; i < WAITER_CNT; i++)
+    sema_up (&shared.sema);
+  cycles = rdtsc () - start;
+  for (i = 0; i < WAITER_CNT; i++)
+    sema_down (&shared.done);
+  thread_set_priority (PRI_DEFAULT);
+
+  msg ("sema_up: %"PRIu64" cycles on average with %d waiters",
+       cycles / WAITER_CNT, WAITER_CNT);
+}
+
+/* Creates WAITER_CNT waiters, each of which blocks on SHARED's
+   semaphore before this function returns. */
+static void
+create_waiters (struct waiters *shared, struct waiter waiters[]) 
+{
+  int i;
+
+  sema_init (&shared->sema, 0);
+  sema_init (&shared->done, 0);
+  shared->woken_cnt = 0;
+
+  /* Every waiter outranks us, so it runs and blocks as soon as it
+     is created. */
+  thread_set_priority (PRI_MIN);
+  for (i = 0; i < WAITER_CNT; i++) 
+    {
+      char name[16];
+
+      waiters[i].shared = shared;
+      waiters[i].idx = i;
+      snprintf (name, sizeof name, "%d", i);
+      thread_create (name, WAITER_PRIORITY (i), waiter_thread, &waiters[i]);
+    }
+}
+
+static void
+waiter_thread (void *w_) 
+{
+  struct waiter *w = w_;
+  struct waiters *shared = w->shared;
+
+  sema_down (&shared->sema);
+  shared->order[shared->woken_cnt++] = w->idx;
+  sema_up (&shared->done);
+}
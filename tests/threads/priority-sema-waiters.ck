@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "Waiters did not wake in priority order.\n"
+  if !grep (/^\(priority-sema-waiters\) 1000 waiters woke in priority order, FIFO among equals\.$/, @output);
+fail "sema_up cost not reported.\n"
+  if !grep (/^\(priority-sema-waiters\) sema_up: \d+ cycles on average with 1000 waiters$/, @output);
+pass;
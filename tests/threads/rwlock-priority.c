@@ -0,0 +1,73 @@
+/* Checks that a readers-writer lock prefers writers, donates the
+   priority of queued threads to the writer, and lets queued
+   threads in by priority.
+
+   The main thread first holds the lock for reading while a
+   writer and then a higher-priority reader ask for it: the reader
+   must wait for the writer.  Then the main thread holds it for
+   writing while two readers of different priority queue up: the
+   main thread must run at the higher priority until it releases
+   the lock, and the higher-priority reader must get in first. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func reader_thread;
+static thread_func writer_thread;
+
+void
+test_rwlock_priority (void) 
+{
+  struct rwlock rw;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rw);
+
+  rwlock_acquire_read (&rw);
+  msg ("Main thread acquired lock for reading.");
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread, &rw);
+  thread_create ("reader", PRI_DEFAULT + 4, reader_thread, &rw);
+  msg ("Main thread releasing lock.");
+  rwlock_release_read (&rw);
+
+  rwlock_acquire_write (&rw);
+  msg ("Main thread acquired lock for writing.");
+  thread_create ("reader 1", PRI_DEFAULT + 1, reader_thread, &rw);
+  msg ("Main thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 1, thread_get_priority ());
+  thread_create ("reader 2", PRI_DEFAULT + 2, reader_thread, &rw);
+  msg ("Main thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 2, thread_get_priority ());
+  rwlock_release_write (&rw);
+  msg ("Main thread finished.");
+}
+
+static void
+reader_thread (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_read (rw);
+  msg ("Thread %s acquired lock for reading.", thread_name ());
+  rwlock_release_read (rw);
+  msg ("Thread %s finished.", thread_name ());
+}
+
+static void
+writer_thread (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_write (rw);
+  msg ("Thread %s acquired lock for writing.", thread_name ());
+  rwlock_release_write (rw);
+  msg ("Thread %s finished.", thread_name ());
+}
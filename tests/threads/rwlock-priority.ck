@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-priority) begin
+(rwlock-priority) Main thread acquired lock for reading.
+(rwlock-priority) Main thread releasing lock.
+(rwlock-priority) Thread writer acquired lock for writing.
+(rwlock-priority) Thread reader acquired lock for reading.
+(rwlock-priority) Thread reader finished.
+(rwlock-priority) Thread writer finished.
+(rwlock-priority) Main thread acquired lock for writing.
+(rwlock-priority) Main thread should have priority 32.  Actual priority: 32.
+(rwlock-priority) Main thread should have priority 33.  Actual priority: 33.
+(rwlock-priority) Thread reader 2 acquired lock for reading.
+(rwlock-priority) Thread reader 2 finished.
+(rwlock-priority) Thread reader 1 acquired lock for reading.
+(rwlock-priority) Thread reader 1 finished.
+(rwlock-priority) Main thread finished.
+(rwlock-priority) end
+EOF
+pass;
@@ -0,0 +1,136 @@
+/* Runs N reader threads and a writer against one readers-writer
+   lock for TEST_TICKS timer ticks.  The writer updates a pair of
+   counters once a tick, yielding halfway through, and the readers
+   check that they never see the pair out of step.  Reports the
+   number of reads completed, as a measure of read throughput. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define TEST_TICKS 100
+#define READER_MAX 32
+
+static void test_rwlock_read (int reader_cnt);
+
+void
+test_rwlock_read_1 (void) 
+{
+  test_rwlock_read (1);
+}
+
+void
+test_rwlock_read_8 (void) 
+{
+  test_rwlock_read (8);
+}
+
+void
+test_rwlock_read_32 (void) 
+{
+  test_rwlock_read (32);
+}
+
+/* Information about the test. */
+struct rwlock_test 
+  {
+    struct rwlock rw;           /* Lock under test. */
+    int64_t start;              /* Current time at start of test. */
+    int a, b;                   /* Counters, equal outside writes. */
+    bool torn;                  /* Has a reader seen A != B? */
+    struct semaphore done;      /* Upped by each thread when done. */
+  };
+
+/* Information about an individual reader or the writer. */
+struct rwlock_thread 
+  {
+    struct rwlock_test *test;   /* Info shared between all threads. */
+    int64_t ops;                /* Reads or writes completed. */
+  };
+
+static thread_func reader_thread;
+static thread_func writer_thread;
+
+static void
+test_rwlock_read (int reader_cnt) 
+{
+  static struct rwlock_test test;
+  static struct rwlock_thread readers[READER_MAX], writer;
+  int64_t read_cnt = 0;
+  int i;
+
+  ASSERT (reader_cnt <= READER_MAX);
+
+  rwlock_init (&test.rw);
+  test.start = timer_ticks ();
+  test.a = test.b = 0;
+  test.torn = false;
+  sema_init (&test.done, 0);
+
+  for (i = 0; i < reader_cnt; i++) 
+    {
+      char name[16];
+
+      readers[i].test = &test;
+      readers[i].ops = 0;
+      snprintf (name, sizeof name, "r%d", i);
+      thread_create (name, PRI_DEFAULT, reader_thread, &readers[i]);
+    }
+  writer.test = &test;
+  writer.ops = 0;
+  thread_create ("writer", PRI_DEFAULT, writer_thread, &writer);
+
+  for (i = 0; i < reader_cnt + 1; i++)
+    sema_down (&test.done);
+
+  if (test.torn)
+    fail ("a reader saw a write in progress");
+  if (test.a != writer.ops || test.b != writer.ops)
+    fail ("counters are %d and %d after %lld writes",
+          test.a, test.b, writer.ops);
+  msg ("%d readers never saw a write in progress.", reader_cnt);
+
+  for (i = 0; i < reader_cnt; i++)
+    read_cnt += readers[i].ops;
+  msg ("%d readers: %lld reads, %lld writes in %d ticks",
+       reader_cnt, read_cnt, writer.ops, TEST_TICKS);
+}
+
+static void
+reader_thread (void *t_) 
+{
+  struct rwlock_thread *t = t_;
+  struct rwlock_test *test = t->test;
+
+  while (timer_elapsed (test->start) < TEST_TICKS) 
+    {
+      rwlock_acquire_read (&test->rw);
+      if (test->a != test->b)
+        test->torn = true;
+      rwlock_release_read (&test->rw);
+      t->ops++;
+    }
+  sema_up (&test->done);
+}
+
+static void
+writer_thread (void *t_) 
+{
+  struct rwlock_thread *t = t_;
+  struct rwlock_test *test = t->test;
+
+  while (timer_elapsed (test->start) < TEST_TICKS) 
+    {
+      timer_sleep (1);
+      rwlock_acquire_write (&test->rw);
+      test->a++;
+      thread_yield ();
+      test->b++;
+      rwlock_release_write (&test->rw);
+      t->ops++;
+    }
+  sema_up (&test->done);
+}
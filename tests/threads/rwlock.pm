@@ -0,0 +1,22 @@
+sub check_rwlock_read {
+    my ($readers) = @_;
+    our ($test);
+
+    @output = read_text_file ("$test.output");
+    common_checks ("run", @output);
+
+    fail "Readers saw a write in progress.\n"
+      if !grep (/^\(rwlock-read-$readers\) $readers readers never saw a write in progress\.$/, @output);
+
+    my ($reads, $writes);
+    foreach (@output) {
+	($reads, $writes) = /^\(rwlock-read-$readers\) $readers readers: (\d+) reads, (\d+) writes in \d+ ticks$/
+	  and last;
+    }
+    fail "Read throughput not reported.\n" if !defined $reads;
+    fail "Readers made no progress.\n" if $reads == 0;
+    fail "Writer made no progress.\n" if $writes == 0;
+    pass;
+}
+
+1;
@@ -0,0 +1,73 @@
+/* Measures the average cost of a context switch through the run
+   queue with 10, 100 and 1000 threads ready at the same time.
+
+   Every thread yields ITER_CNT times, so the run queue holds
+   THREAD_CNT threads for the whole measurement.  With an O(1)
+   run queue the cost per switch should not grow with the
+   number of ready threads. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "intrinsic.h"
+
+#define ITER_CNT 16
+
+static thread_func yield_thread;
+static void measure (int thread_cnt);
+
+void
+test_sched_latency (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  measure (10);
+  measure (100);
+  measure (1000);
+}
+
+/* Runs THREAD_CNT threads that each yield ITER_CNT times and
+   reports the average number of TSC cycles per switch. */
+static void
+measure (int thread_cnt) 
+{
+  struct semaphore done;
+  uint64_t start, cycles;
+  int i;
+
+  sema_init (&done, 0);
+  for (i = 0; i < thread_cnt; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "%d", i);
+      if (thread_create (name, PRI_DEFAULT, yield_thread, &done) == TID_ERROR)
+        fail ("creating thread %d of %d failed", i, thread_cnt);
+    }
+
+  /* The threads have our priority, so none has run yet. */
+  start = rdtsc ();
+  for (i = 0; i < thread_cnt; i++)
+    sema_down (&done);
+  cycles = rdtsc () - start;
+
+  msg ("%4d ready threads: %"PRIu64" cycles per switch",
+       thread_cnt, cycles / ((uint64_t) thread_cnt * (ITER_CNT + 1)));
+}
+
+static void 
+yield_thread (void *done_) 
+{
+  struct semaphore *done = done_;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    thread_yield ();
+  sema_up (done);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+for my $cnt (10, 100, 1000) {
+    fail "No context-switch latency reported for $cnt threads.\n"
+      if !grep (/^\(sched-latency\)\s+$cnt ready threads: \d+ cycles per switch$/,
+		@output);
+}
+pass;
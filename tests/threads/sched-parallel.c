@@ -0,0 +1,114 @@
+/* Measures the throughput of 1, 2, 4 and 8 CPU-bound kernel
+   threads, each of which counts units of busy work for TEST_TICKS
+   timer ticks, and reports it relative to a single thread.  With
+   the load spread over the online CPUs, throughput should grow
+   nearly linearly up to the number of CPUs and stay flat beyond
+   it. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/cpu.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define TEST_TICKS 50
+#define THREAD_MAX 8
+#define UNIT_LOOPS 1000
+
+/* Information about the test. */
+struct parallel_test 
+  {
+    int64_t start;              /* Current time at start of run. */
+    int64_t units[THREAD_MAX];  /* Units of work done per thread. */
+    struct semaphore done;      /* Upped by each thread when done. */
+  };
+
+/* Information about an individual thread. */
+struct parallel_thread 
+  {
+    struct parallel_test *test;
+    int idx;
+  };
+
+static int64_t run (int thread_cnt);
+static thread_func busy_thread;
+
+void
+test_sched_parallel (void) 
+{
+  int64_t base = 0;
+  int thread_cnt;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  for (thread_cnt = 1; thread_cnt <= THREAD_MAX; thread_cnt *= 2) 
+    {
+      int64_t units = run (thread_cnt);
+
+      if (thread_cnt == 1)
+        base = units;
+      if (units == 0 || base == 0)
+        fail ("%d threads did no work", thread_cnt);
+      msg ("%d threads on %d CPUs: %lld units, %lld%% of 1 thread",
+           thread_cnt, cpu_online_cnt (), units, units * 100 / base);
+    }
+}
+
+/* Runs THREAD_CNT busy threads for TEST_TICKS and returns the
+   total units of work they did. */
+static int64_t
+run (int thread_cnt) 
+{
+  static struct parallel_test test;
+  static struct parallel_thread threads[THREAD_MAX];
+  int64_t units = 0;
+  int i;
+
+  sema_init (&test.done, 0);
+
+  /* Stay above the threads until all have been created, so they
+     start together. */
+  thread_set_priority (PRI_DEFAULT + 1);
+  test.start = timer_ticks ();
+  for (i = 0; i < thread_cnt; i++) 
+    {
+      char name[16];
+
+      threads[i].test = &test;
+      threads[i].idx = i;
+      test.units[i] = 0;
+      snprintf (name, sizeof name, "busy %d", i);
+      thread_create (name, PRI_DEFAULT, busy_thread, &threads[i]);
+    }
+  thread_set_priority (PRI_DEFAULT);
+
+  for (i = 0; i < thread_cnt; i++) 
+    {
+      sema_down (&test.done);
+    }
+  for (i = 0; i < thread_cnt; i++)
+    units += test.units[i];
+  return units;
+}
+
+static void
+busy_thread (void *t_) 
+{
+  struct parallel_thread *t = t_;
+  struct parallel_test *test = t->test;
+  int64_t units = 0;
+
+  while (timer_elapsed (test->start) < TEST_TICKS) 
+    {
+      volatile int i;
+
+      for (i = 0; i < UNIT_LOOPS; i++)
+        continue;
+      units++;
+    }
+  test->units[t->idx] = units;
+  sema_up (&test->done);
+}
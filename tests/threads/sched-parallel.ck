@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# With more than one CPU online, N threads should get at least
+# 70% of N times the throughput of one thread, up to the number of
+# CPUs.  With one CPU, there is no scaling to check.
+foreach my $threads (1, 2, 4, 8) {
+    my ($line) = grep (/^\(sched-parallel\) $threads threads on \d+ CPUs: \d+ units, \d+% of 1 thread$/, @output);
+    fail "Throughput of $threads threads not reported.\n" if !defined $line;
+
+    my ($cpus, $percent) = $line =~ /on (\d+) CPUs: \d+ units, (\d+)%/;
+    next if $cpus < 2;
+    my ($expected) = ($threads < $cpus ? $threads : $cpus) * 100;
+    fail "$threads threads on $cpus CPUs got $percent% of 1 thread, "
+      . "expected at least " . int ($expected * 0.7) . "%.\n"
+      if $percent < $expected * 0.7;
+}
+pass;
@@ -0,0 +1,99 @@
+/* Measures the cost of switching back and forth between two
+   address spaces, each of which touches TOUCH_PAGES pages of its
+   own after every switch, the way two processes ping-ponging
+   through a pipe would.  Runs once with every switch flushing
+   the TLB and once with PCID-tagged address spaces, if the CPU
+   has PCIDs. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/tlb.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+#define TOUCH_PAGES 64
+#define ROUNDS 1000
+
+/* Where both address spaces map their pages. */
+#define TOUCH_BASE ((uint8_t *) 0x10000000)
+
+static uint64_t *make_space (int fill);
+static uint64_t pingpong (uint64_t *a, uint64_t *b);
+
+void
+test_tlb_pingpong (void) 
+{
+  uint64_t *a = make_space (1);
+  uint64_t *b = make_space (2);
+  uint64_t cycles;
+
+  tlb_set_pcid (false);
+  cycles = pingpong (a, b);
+  msg ("without PCID: %llu cycles per switch", cycles);
+
+  if (tlb_set_pcid (true)) 
+    {
+      cycles = pingpong (a, b);
+      msg ("with PCID: %llu cycles per switch", cycles);
+    }
+  else
+    msg ("with PCID: not supported");
+
+  pml4_destroy (a);
+  pml4_destroy (b);
+}
+
+/* Returns a new address space with TOUCH_PAGES pages mapped at
+   TOUCH_BASE, each holding FILL in its first byte. */
+static uint64_t *
+make_space (int fill) 
+{
+  uint64_t *pml4 = pml4_create ();
+  int i;
+
+  if (pml4 == NULL)
+    fail ("out of memory");
+  for (i = 0; i < TOUCH_PAGES; i++) 
+    {
+      uint8_t *kpage = palloc_get_page (PAL_USER);
+
+      if (kpage == NULL
+          || !pml4_set_page (pml4, TOUCH_BASE + i * PGSIZE, kpage, true))
+        fail ("out of memory");
+      kpage[0] = fill;
+    }
+  return pml4;
+}
+
+/* Returns the average cycles per switch between A and B. */
+static uint64_t
+pingpong (uint64_t *a, uint64_t *b) 
+{
+  enum intr_level old_level;
+  uint64_t start, end;
+  int round, i;
+
+  /* With interrupts off no other thread can run and load its own
+     page tables behind our back. */
+  old_level = intr_disable ();
+  start = rdtsc ();
+  for (round = 0; round < ROUNDS * 2; round++) 
+    {
+      uint64_t *pml4 = round % 2 ? b : a;
+      int fill = round % 2 ? 2 : 1;
+
+      pml4_activate (pml4);
+      for (i = 0; i < TOUCH_PAGES; i++)
+        if (*(volatile uint8_t *) (TOUCH_BASE + i * PGSIZE) != fill)
+          fail ("page %d of address space %d reads wrong data", i, fill);
+    }
+  end = rdtsc ();
+  pml4_activate (NULL);
+  intr_set_level (old_level);
+
+  return (end - start) / (ROUNDS * 2);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+fail "No cost reported without PCID.\n"
+  if !grep (/^\(tlb-pingpong\) without PCID: \d+ cycles per switch$/, @output);
+fail "No cost reported with PCID.\n"
+  if !grep (/^\(tlb-pingpong\) with PCID: (\d+ cycles per switch|not supported)$/,
+	    @output);
+pass;
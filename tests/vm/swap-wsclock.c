@@ -0,0 +1,36 @@
+/* Checks that pages are swapped out and back in properly under
+   the WSClock policy, with Pintos booted with "-wsclock" and 10 MB
+   of memory.  The default working-set window is longer than the
+   test runs, so every page stays in its working set and each
+   eviction has to settle for the page unused longest. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define CHUNK_SIZE (20 * 1024 * 1024)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+
+static char big_chunk[CHUNK_SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    {
+      if (i % 1024 == 0)
+        msg ("write page %zu", i);
+      big_chunk[i * PAGE_SIZE] = (char) i;
+    }
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    {
+      if (big_chunk[i * PAGE_SIZE] != (char) i)
+        fail ("page %zu is inconsistent", i);
+      if (i % 1024 == 0)
+        msg ("check page %zu", i);
+    }
+}
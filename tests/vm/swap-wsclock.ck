@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-wsclock) begin
+(swap-wsclock) write page 0
+(swap-wsclock) write page 1024
+(swap-wsclock) write page 2048
+(swap-wsclock) write page 3072
+(swap-wsclock) write page 4096
+(swap-wsclock) check page 0
+(swap-wsclock) check page 1024
+(swap-wsclock) check page 2048
+(swap-wsclock) check page 3072
+(swap-wsclock) check page 4096
+(swap-wsclock) end
+EOF
+pass;
@@ -0,0 +1,364 @@
+#include "threads/cpu.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Intel MultiProcessor Specification, version 1.4.  The BIOS
+   describes the processors and I/O APICs in an MP configuration
+   table, found through an MP floating pointer structure that
+   lies in one of the areas searched by mp_find(). */
+
+/* MP floating pointer structure. */
+struct mp_fps {
+	char signature[4];          /* "_MP_". */
+	uint32_t config;            /* Physical address of mp_config. */
+	uint8_t length;             /* Length in 16-byte units (1). */
+	uint8_t spec_rev;           /* Specification revision. */
+	uint8_t checksum;           /* All bytes add up to 0. */
+	uint8_t type;               /* Default configuration, or 0. */
+	uint8_t features[4];        /* Feature flags. */
+} __attribute__((packed));
+
+/* MP configuration table header. */
+struct mp_config {
+	char signature[4];          /* "PCMP". */
+	uint16_t length;            /* Length, including entries. */
+	uint8_t version;            /* Specification revision. */
+	uint8_t checksum;           /* All bytes add up to 0. */
+	char oem_id[8];
+	char product_id[12];
+	uint32_t oem_table;
+	uint16_t oem_length;
+	uint16_t entry_cnt;         /* Number of entries that follow. */
+	uint32_t lapic;             /* Physical address of local APICs. */
+	uint16_t ext_length;
+	uint8_t ext_checksum;
+	uint8_t reserved;
+} __attribute__((packed));
+
+/* MP configuration table entry types. */
+enum mp_entry_type {
+	MP_PROCESSOR = 0,           /* One processor. 20 bytes. */
+	MP_BUS = 1,                 /* Others are 8 bytes. */
+	MP_IOAPIC = 2,
+	MP_IOINTR = 3,
+	MP_LINTR = 4
+};
+
+/* Processor entry. */
+struct mp_processor {
+	uint8_t type;               /* MP_PROCESSOR. */
+	uint8_t apic_id;            /* Local APIC ID. */
+	uint8_t apic_version;
+	uint8_t flags;              /* MP_CPU_* below. */
+	uint32_t signature;
+	uint32_t features;
+	uint32_t reserved[2];
+} __attribute__((packed));
+
+#define MP_CPU_ENABLED 0x01     /* Usable. */
+#define MP_CPU_BSP 0x02         /* Bootstrap processor. */
+
+/* I/O APIC entry. */
+struct mp_ioapic {
+	uint8_t type;               /* MP_IOAPIC. */
+	uint8_t apic_id;
+	uint8_t version;
+	uint8_t flags;
+	uint32_t address;           /* Physical address. */
+} __attribute__((packed));
+
+/* Local APIC registers, as indexes into lapic[].  See [IA32-v3a]
+   chapter 10 "Advanced Programmable Interrupt Controller". */
+#define LAPIC_SVR (0x0f0 / 4)       /* Spurious interrupt vector. */
+#define LAPIC_ICR_LO (0x300 / 4)    /* Interrupt command, low half. */
+#define LAPIC_ICR_HI (0x310 / 4)    /* Interrupt command, high half. */
+
+#define SVR_ENABLE 0x100            /* APIC software enable. */
+#define SVR_VECTOR 0xff             /* Spurious interrupt vector. */
+
+#define ICR_INIT 0x00000500         /* INIT delivery mode. */
+#define ICR_STARTUP 0x00000600      /* Startup delivery mode. */
+#define ICR_PENDING 0x00001000      /* Delivery status: not sent yet. */
+#define ICR_ASSERT 0x00004000       /* Level: assert. */
+#define ICR_LEVEL 0x00008000        /* Level triggered. */
+
+/* I/O APIC registers are read through a window, after writing
+   the register's index to the select register. */
+#define IOAPIC_SELECT (0x00 / 4)
+#define IOAPIC_WINDOW (0x10 / 4)
+#define IOAPIC_VERSION 0x01         /* Bits 16...23: last pin. */
+
+/* The CPUs, bootstrap processor first. */
+struct cpu cpus[CPU_MAX];
+int cpu_cnt = 1;
+
+volatile uint32_t *lapic;
+uint8_t cpu_by_apic_id[256];
+
+static int online_cnt = 1;      /* Number of CPUs online. */
+static int ioapic_cnt;          /* Number of I/O APICs. */
+static uint32_t ioapic_addr;    /* Physical address of the first one. */
+static int ioapic_pins;         /* Its number of interrupt pins. */
+static uint32_t lapic_addr;     /* Physical address of local APICs. */
+
+/* The local APIC registers, mapped.  lapic points here once a
+   second CPU starts. */
+static volatile uint32_t *lapic_regs;
+
+/* Parameters at the end of threads/ap-start.S. */
+extern char ap_start[], ap_end[];
+extern uint64_t ap_boot_cr3, ap_cr3, ap_stack, ap_entry, ap_arg;
+
+static struct mp_fps *mp_find (void);
+static struct mp_fps *mp_search (uint64_t start, size_t size);
+static bool mp_checksum (const void *, size_t size);
+static volatile uint32_t *map_registers (uint64_t pa);
+static bool ap_boot (struct cpu *);
+static void ap_main (struct cpu *) NO_RETURN;
+static uint64_t *ap_param (uint64_t *);
+static void lapic_ipi (uint8_t apic_id, uint32_t icr);
+
+/* Finds the CPUs and I/O APICs that the MP configuration table
+   lists, and maps the local APIC and the first I/O APIC.  Without
+   a table, the bootstrap processor is the only CPU.  Must be
+   called after paging_init(), which maps the low megabyte where
+   the table lives. */
+void
+cpu_init (void) {
+	struct mp_fps *fps = mp_find ();
+	struct mp_config *config;
+	uint8_t *p, *end;
+
+	cpus[0].online = true;
+	if (fps == NULL || fps->config == 0 || fps->config >= 0x100000)
+		return;
+	config = ptov (fps->config);
+	if (memcmp (config->signature, "PCMP", 4)
+			|| !mp_checksum (config, config->length))
+		return;
+
+	lapic_addr = config->lapic;
+	p = (uint8_t *) (config + 1);
+	end = (uint8_t *) config + config->length;
+	while (p < end) {
+		if (*p == MP_PROCESSOR) {
+			struct mp_processor *proc = (struct mp_processor *) p;
+
+			if (proc->flags & MP_CPU_BSP)
+				cpus[0].apic_id = proc->apic_id;
+			else if ((proc->flags & MP_CPU_ENABLED) && cpu_cnt < CPU_MAX) {
+				cpus[cpu_cnt].apic_id = proc->apic_id;
+				cpu_by_apic_id[proc->apic_id] = cpu_cnt;
+				cpu_cnt++;
+			}
+			p += sizeof *proc;
+		} else if (*p == MP_IOAPIC) {
+			struct mp_ioapic *ioapic = (struct mp_ioapic *) p;
+
+			if (ioapic_cnt++ == 0)
+				ioapic_addr = ioapic->address;
+			p += sizeof *ioapic;
+		} else if (*p <= MP_LINTR)
+			p += 8;
+		else
+			break;
+	}
+
+	if (lapic_addr != 0)
+		lapic_regs = map_registers (lapic_addr);
+	if (ioapic_addr != 0) {
+		volatile uint32_t *ioapic = map_registers (ioapic_addr);
+
+		/* Interrupts keep coming through the 8259 PIC, so the I/O
+		   APIC's pins are left masked, as the BIOS hands them over. */
+		ioapic[IOAPIC_SELECT] = IOAPIC_VERSION;
+		ioapic_pins = ((ioapic[IOAPIC_WINDOW] >> 16) & 0xff) + 1;
+	}
+	printf ("cpu: %d CPUs found, 1 online\n", cpu_cnt);
+}
+
+/* Starts the application processors that cpu_init() found, one
+   at a time, and reports how many CPUs are online.  Each one is
+   sent an INIT and two startup IPIs, as the MP specification
+   describes, and then given 100 ms to come up.  Must be called
+   after timer_calibrate(), since it needs timer delays. */
+void
+cpu_start_aps (void) {
+	uint64_t start = rdtsc ();
+	int i;
+
+	if (lapic_regs != NULL && cpu_cnt > 1) {
+		extern uint64_t boot_pml4e[];
+
+		memcpy (ptov (LOADER_AP_START), ap_start, ap_end - ap_start);
+		*ap_param (&ap_boot_cr3) = vtop (boot_pml4e);
+		*ap_param (&ap_cr3) = vtop (base_pml4);
+		*ap_param (&ap_entry) = (uint64_t) ap_main;
+
+		/* From now on cpu_current() has to ask the local APIC. */
+		cpu_by_apic_id[lapic_regs[LAPIC_ID] >> 24] = 0;
+		lapic = lapic_regs;
+
+		for (i = 1; i < cpu_cnt; i++)
+			if (!ap_boot (&cpus[i])) {
+				/* It might still start later, so keep its parameters. */
+				printf ("cpu: CPU %d (local APIC %d) did not start\n",
+						i, cpus[i].apic_id);
+				break;
+			}
+	}
+
+	printf ("cpu: %d CPUs found, %d online", cpu_cnt, cpu_online_cnt ());
+	if (lapic_addr != 0)
+		printf (" in %'"PRIu64" cycles (%d I/O APICs, the first with %d pins, "
+				"local APIC at %#"PRIx32")", rdtsc () - start, ioapic_cnt,
+				ioapic_pins, lapic_addr);
+	printf ("\n");
+}
+
+/* Returns the number of CPUs running the kernel. */
+int
+cpu_online_cnt (void) {
+	return __atomic_load_n (&online_cnt, __ATOMIC_RELAXED);
+}
+
+/* Starts application processor C in ap_main(), running in a new
+   idle thread.  Returns true if it came online. */
+static bool
+ap_boot (struct cpu *c) {
+	void *page = palloc_get_page (PAL_ZERO);
+	int ms;
+
+	if (page == NULL)
+		return false;
+	thread_init_ap (c, page);
+	*ap_param (&ap_stack) = (uint64_t) page + PGSIZE;
+	*ap_param (&ap_arg) = (uint64_t) c;
+	barrier ();
+
+	lapic_ipi (c->apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+	timer_usleep (200);
+	lapic_ipi (c->apic_id, ICR_INIT | ICR_LEVEL);
+	timer_msleep (10);
+	for (int i = 0; i < 2; i++) {
+		lapic_ipi (c->apic_id, ICR_STARTUP | LOADER_AP_START >> 12);
+		timer_usleep (200);
+	}
+
+	for (ms = 0; ms < 100; ms++) {
+		if (__atomic_load_n (&c->online, __ATOMIC_ACQUIRE))
+			return true;
+		timer_msleep (1);
+	}
+	return false;
+}
+
+/* Where application processor C starts running C code, on the
+   stack of its idle thread.  It loads the IDT, enables its local
+   APIC, so that it can take IPIs later, and reports for duty.
+   It does not schedule threads yet, so it then stays halted with
+   interrupts off. */
+static void
+ap_main (struct cpu *c) {
+	intr_init_ap ();
+	lapic_regs[LAPIC_SVR] = SVR_ENABLE | SVR_VECTOR;
+	__atomic_fetch_add (&online_cnt, 1, __ATOMIC_RELAXED);
+	__atomic_store_n (&c->online, true, __ATOMIC_RELEASE);
+
+	for (;;)
+		asm volatile ("cli; hlt" : : : "memory");
+}
+
+/* Returns the copy at LOADER_AP_START of PARAM, one of the
+   parameters in threads/ap-start.S. */
+static uint64_t *
+ap_param (uint64_t *param) {
+	return ptov (LOADER_AP_START + ((char *) param - ap_start));
+}
+
+/* Sends the interprocessor interrupt described by ICR to the
+   CPU whose local APIC ID is APIC_ID, and waits until it has
+   been sent. */
+static void
+lapic_ipi (uint8_t apic_id, uint32_t icr) {
+	lapic_regs[LAPIC_ICR_HI] = (uint32_t) apic_id << 24;
+	lapic_regs[LAPIC_ICR_LO] = icr;
+	while (lapic_regs[LAPIC_ICR_LO] & ICR_PENDING)
+		pause ();
+}
+
+/* Maps the page of device registers at physical address PA,
+   uncached, at its place in the kernel's view of physical memory,
+   and returns their kernel virtual address.  Page tables made by
+   pml4_create() afterward share the mapping.
+
+   With enough RAM, paging_init() maps that place with a 2 MiB
+   page, which is split first, so that only the registers' page
+   turns uncached.  PCIDs are not on yet, so invalidating the
+   address in the current TLB is enough. */
+static volatile uint32_t *
+map_registers (uint64_t pa) {
+	uint64_t va = (uint64_t) ptov (pa);
+	uint64_t *pte = NULL;
+
+	if (pml4_split_large_page (base_pml4, va))
+		pte = pml4e_walk (base_pml4, va, 1);
+	if (pte == NULL)
+		PANIC ("cpu: no memory to map registers at %#"PRIx64, pa);
+	ASSERT (!(*pte & PTE_PS));
+	*pte = (pa & ~PGMASK) | PTE_P | PTE_W | PTE_PCD | PTE_PWT;
+	invlpg (va);
+	return (volatile uint32_t *) va;
+}
+
+/* Searches the areas where the MP floating pointer structure may
+   lie, in the order the specification gives: the first KB of the
+   extended BIOS data area, the last KB of base memory, and the
+   BIOS ROM.  Returns the structure, or a null pointer if there
+   is none. */
+static struct mp_fps *
+mp_find (void) {
+	uint8_t *bda = ptov (0x400);
+	uint64_t ebda = (uint64_t) (bda[0x0f] << 8 | bda[0x0e]) << 4;
+	uint64_t base_kb = bda[0x14] << 8 | bda[0x13];
+	struct mp_fps *fps;
+
+	if (ebda != 0 && (fps = mp_search (ebda, 1024)) != NULL)
+		return fps;
+	if (base_kb != 0 && (fps = mp_search (base_kb * 1024 - 1024, 1024)) != NULL)
+		return fps;
+	return mp_search (0xf0000, 0x10000);
+}
+
+/* Looks for an MP floating pointer structure within SIZE bytes
+   of physical memory starting at START. */
+static struct mp_fps *
+mp_search (uint64_t start, size_t size) {
+	uint8_t *p = ptov (start), *end = p + size;
+
+	for (; p + sizeof (struct mp_fps) <= end; p += sizeof (struct mp_fps))
+		if (!memcmp (p, "_MP_", 4) && mp_checksum (p, sizeof (struct mp_fps)))
+			return (struct mp_fps *) p;
+	return NULL;
+}
+
+/* Returns true if the SIZE bytes at P add up to 0. */
+static bool
+mp_checksum (const void *p_, size_t size) {
+	const uint8_t *p = p_;
+	uint8_t sum = 0;
+
+	while (size-- > 0)
+		sum += *p++;
+	return sum == 0;
+}
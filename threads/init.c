@@ -13,6 +13,7 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -20,7 +21,11 @@
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/sched-trace.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/tlb.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -37,6 +42,7 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#include "intrinsic.h"
 
 /* Page-map-level-4 with kernel mappings only. */
 uint64_t *base_pml4;
@@ -86,6 +92,8 @@ main (void) {
 	mem_end = palloc_init ();
 	malloc_init ();
 	paging_init (mem_end);
+	cpu_init ();
+	tlb_init ();
 
 #ifdef USERPROG
 	tss_init ();
@@ -142,29 +150,56 @@ bss_init (void) {
 
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ *
+ * Physical memory is mapped with 2 MiB pages, except for the
+ * 2 MiB regions that hold kernel text, which must be read-only,
+ * and a partial region at MEM_END, which get 4 kB pages.  This
+ * saves a page table per 2 MiB and lets each TLB entry cover 512
+ * times as much memory.  1 GiB pages would need virtual and
+ * physical addresses to agree modulo 1 GiB, but LOADER_KERN_BASE
+ * is only 64 MiB-aligned, so they are never used. */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
+	size_t large_cnt = 0, small_cnt = 0;
+	uint64_t start_tsc = rdtsc ();
 	int perm;
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	uint64_t text_start = vtop (&start);
+	uint64_t text_end = vtop (&_end_kernel_text);
+
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (uint64_t pa = 0; pa < mem_end; ) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		if (pa % LARGE_PGSIZE == 0 && pa + LARGE_PGSIZE <= mem_end
+				&& (pa + LARGE_PGSIZE <= text_start || pa >= text_end)) {
+			pml4_set_large_page (pml4, va, pa, PTE_P | PTE_W);
+			pa += LARGE_PGSIZE;
+			large_cnt++;
+			continue;
+		}
+
 		perm = PTE_P | PTE_W;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
 		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
 			*pte = pa | perm;
+		pa += PGSIZE;
+		small_cnt++;
 	}
 
 	// reload cr3
 	pml4_activate(0);
+
+	printf ("paging: direct map of %'llu kB in %zu 2 MiB and %zu 4 kB "
+			"pages, built in %'llu cycles\n", mem_end / 1024, large_cnt,
+			small_cnt, rdtsc () - start_tsc);
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -221,6 +256,12 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-sched-trace"))
+			sched_trace_at_power_off = true;
+#ifdef VM
+		else if (!strcmp (name, "-wsclock"))
+			vm_ws_window = value != NULL ? atoi (value) : 100;
+#endif
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
@@ -326,8 +367,12 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -sched-trace       Print the scheduler trace at power off.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -wsclock[=TICKS]   Evict with WSClock, working-set window TICKS.\n"
 #endif
 			);
 	power_off ();
@@ -353,13 +398,26 @@ power_off (void) {
 static void
 print_stats (void) {
 	timer_print_stats ();
+	intr_print_stats ();
 	thread_print_stats ();
+	tlb_print_stats ();
+	palloc_print_stats ();
+	kmem_print_stats ();
+#ifdef MALLOC_PROFILE
+	malloc_print_stats ();
+#endif
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
+	lock_print_stats ();
+	if (sched_trace_at_power_off)
+		sched_trace_dump ();
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
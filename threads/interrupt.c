@@ -103,6 +103,14 @@ static const char *intr_names[INTR_CNT];
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* How long interrupts stay off, in CPU cycles.  A stretch starts
+   in intr_disable() or on entry to an interrupt gate, and ends in
+   intr_enable() or on return from an external interrupt,
+   possibly in another thread. */
+static uint64_t intr_off_start; /* Start of the current stretch. */
+static uint64_t intr_off_max;   /* Longest stretch so far. */
+static void intr_off_end (void);
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -137,6 +145,9 @@ intr_enable (void) {
 	enum intr_level old_level = intr_get_level ();
 	ASSERT (!intr_context ());
 
+	if (old_level == INTR_OFF)
+		intr_off_end ();
+
 	/* Enable interrupts by setting the interrupt flag.
 
 	   See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -156,9 +167,30 @@ intr_disable (void) {
 	   Hardware Interrupts". */
 	asm volatile ("cli" : : : "memory");
 
+	if (old_level == INTR_ON)
+		intr_off_start = rdtsc ();
+
 	return old_level;
 }
 
+/* Ends the current stretch with interrupts off, if one has been
+   started.  Interrupts must be off. */
+static void
+intr_off_end (void) {
+	if (intr_off_start != 0) {
+		uint64_t cycles = rdtsc () - intr_off_start;
+		if (cycles > intr_off_max)
+			intr_off_max = cycles;
+		intr_off_start = 0;
+	}
+}
+
+/* Prints the longest stretch with interrupts off. */
+void
+intr_print_stats (void) {
+	printf ("Interrupts: off for at most %"PRIu64" cycles\n", intr_off_max);
+}
+
 /* Initializes the interrupt system. */
 void
 intr_init (void) {
@@ -203,6 +235,13 @@ intr_init (void) {
 	intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/* Loads the IDT that intr_init() built on an application
+   processor. */
+void
+intr_init_ap (void) {
+	lidt (&idt_desc);
+}
+
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -346,6 +385,10 @@ intr_handler (struct intr_frame *frame) {
 		yield_on_return = false;
 	}
 
+	/* Entering an interrupt gate turned interrupts off. */
+	if (intr_get_level () == INTR_OFF && (frame->eflags & FLAG_IF))
+		intr_off_start = rdtsc ();
+
 	/* Invoke the interrupt's handler. */
 	handler = intr_handlers[frame->vec_no];
 	if (handler != NULL)
@@ -371,6 +414,7 @@ intr_handler (struct intr_frame *frame) {
 
 		if (yield_on_return)
 			thread_yield ();
+		intr_off_end ();
 	}
 }
 
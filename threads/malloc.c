@@ -1,81 +1,105 @@
 #include "threads/malloc.h"
 #include <debug.h>
-#include <list.h>
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
-#include "threads/synch.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
-
-   Otherwise, a new page of memory, called an "arena", is
-   obtained from the page allocator (if none is available,
-   malloc() returns a null pointer).  The new arena is divided
-   into blocks, all of which are added to the descriptor's free
-   list.  Then we return one of the new blocks.
-
-   When we free a block, we add it to its descriptor's free list.
-   But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
-
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
+   The size of each request, in bytes, is rounded up to the
+   nearest of a set of size classes, spaced more finely than
+   powers of 2, each of which is served by a slab cache (see
+   slab.h).
+
+   We can't handle blocks bigger than about 2 kB using this
+   scheme, because two of them don't fit in a single page with a
+   slab header.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
-
-/* Descriptor. */
-struct desc {
-	size_t block_size;          /* Size of each element in bytes. */
-	size_t blocks_per_arena;    /* Number of blocks in an arena. */
-	struct list free_list;      /* List of free blocks. */
-	struct lock lock;           /* Lock. */
-};
+   the beginning of the allocated block's arena header.
+
+   When the kernel is built with MALLOC_PROFILE defined (run
+   "make MALLOC_PROFILE=1"), each block also starts with a tag
+   naming the call site that allocated it, and the bytes and
+   blocks each call site holds are printed at power off, largest
+   first.  Blocks still held then are either long-lived or
+   leaked.  utils/backtrace translates the addresses into
+   function names. */
 
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
-/* Arena. */
+/* Arena holding a big block. */
 struct arena {
 	unsigned magic;             /* Always set to ARENA_MAGIC. */
-	struct desc *desc;          /* Owning descriptor, null for big block. */
-	size_t free_cnt;            /* Free blocks; pages in big block. */
+	size_t page_cnt;            /* Pages in the block. */
 };
 
-/* Free block. */
-struct block {
-	struct list_elem free_elem; /* Free list element. */
+/* Sizes of the size classes, in increasing order.  The last two
+   are the largest multiples of 16 of which a slab holds 3 and 2. */
+static const size_t class_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1344, 2016
+};
+#define CLASS_CNT (sizeof class_sizes / sizeof *class_sizes)
+
+/* The slab cache of each size class. */
+static struct kmem_cache *classes[CLASS_CNT];
+
+#ifdef MALLOC_PROFILE
+/* Maximum number of call sites tracked.  Allocations from any
+   more are charged to OTHER_SITE. */
+#define SITE_CNT 1024
+
+/* A call site of malloc(), calloc(), or realloc(). */
+struct malloc_site {
+	uintptr_t caller;           /* Return address of the call. */
+	size_t live_cnt;            /* Number of blocks allocated. */
+	size_t live_bytes;          /* Bytes in those blocks. */
+	size_t peak_bytes;          /* Maximum of LIVE_BYTES. */
+	long long allocs;           /* Number of blocks ever allocated. */
 };
 
-/* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
-static size_t desc_cnt;         /* Number of descriptors. */
+/* Hash table of call sites, keyed on CALLER, with linear
+   probing.  Protected by disabling interrupts. */
+static struct malloc_site sites[SITE_CNT];
+static struct malloc_site other_site;
 
-static struct arena *block_to_arena (struct block *);
-static struct block *arena_to_block (struct arena *, size_t idx);
+/* Header at the start of each block. */
+struct malloc_tag {
+	struct malloc_site *site;   /* Call site that allocated it. */
+	size_t bytes;               /* Size class, or size of big block. */
+};
+#define TAG_SIZE sizeof (struct malloc_tag)
+
+static void *tag_block (void *, size_t bytes, uintptr_t caller);
+static void *untag_block (void *);
+static bool is_tagged (const void *);
+#define block_base(BLOCK) ((void *) ((struct malloc_tag *) (BLOCK) - 1))
+#else
+#define TAG_SIZE 0
+#define tag_block(BLOCK, BYTES, CALLER) (BLOCK)
+#define untag_block(BLOCK) (BLOCK)
+#define is_tagged(BLOCK) false
+#define block_base(BLOCK) ((void *) (BLOCK))
+#endif
 
-/* Initializes the malloc() descriptors. */
+static void *malloc_at (size_t, uintptr_t caller);
+static struct arena *block_to_arena (void *);
+
+/* Initializes the malloc() size classes. */
 void
 malloc_init (void) {
-	size_t block_size;
-
-	for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
-		struct desc *d = &descs[desc_cnt++];
-		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-		d->block_size = block_size;
-		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-		list_init (&d->free_list);
-		lock_init (&d->lock);
+	size_t i;
+
+	for (i = 0; i < CLASS_CNT; i++) {
+		char name[16];
+
+		snprintf (name, sizeof name, "malloc %zu", class_sizes[i]);
+		classes[i] = kmem_cache_create (name, class_sizes[i], 16, NULL);
 	}
 }
 
@@ -83,64 +107,44 @@ malloc_init (void) {
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
-	struct desc *d;
-	struct block *b;
+	return malloc_at (size, (uintptr_t) __builtin_return_address (0));
+}
+
+/* Allocates a block of at least SIZE bytes for malloc(), on
+   behalf of the call at CALLER. */
+static void *
+malloc_at (size_t size, uintptr_t caller UNUSED) {
 	struct arena *a;
+	void *block;
+	size_t i;
 
 	/* A null pointer satisfies a request for 0 bytes. */
 	if (size == 0)
 		return NULL;
+	size += TAG_SIZE;
 
-	/* Find the smallest descriptor that satisfies a SIZE-byte
+	/* Find the smallest size class that satisfies a SIZE-byte
 	   request. */
-	for (d = descs; d < descs + desc_cnt; d++)
-		if (d->block_size >= size)
-			break;
-	if (d == descs + desc_cnt) {
-		/* SIZE is too big for any descriptor.
-		   Allocate enough pages to hold SIZE plus an arena. */
-		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-		a = palloc_get_multiple (0, page_cnt);
-		if (a == NULL)
-			return NULL;
-
-		/* Initialize the arena to indicate a big block of PAGE_CNT
-		   pages, and return it. */
-		a->magic = ARENA_MAGIC;
-		a->desc = NULL;
-		a->free_cnt = page_cnt;
-		return a + 1;
-	}
-
-	lock_acquire (&d->lock);
-
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
-
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
-			return NULL;
+	for (i = 0; i < CLASS_CNT; i++)
+		if (class_sizes[i] >= size) {
+			block = kmem_cache_alloc (classes[i]);
+			if (block == NULL)
+				return NULL;
+			return tag_block (block, class_sizes[i], caller);
 		}
 
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
-		}
-	}
+	/* SIZE is too big for any size class.
+	   Allocate enough pages to hold SIZE plus an arena. */
+	size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
+	a = palloc_get_multiple (0, page_cnt);
+	if (a == NULL)
+		return NULL;
 
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
-	lock_release (&d->lock);
-	return b;
+	/* Initialize the arena to indicate a big block of PAGE_CNT
+	   pages, and return it. */
+	a->magic = ARENA_MAGIC;
+	a->page_cnt = page_cnt;
+	return tag_block (a + 1, page_cnt * PGSIZE, caller);
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -156,7 +160,7 @@ calloc (size_t a, size_t b) {
 		return NULL;
 
 	/* Allocate and zero memory. */
-	p = malloc (size);
+	p = malloc_at (size, (uintptr_t) __builtin_return_address (0));
 	if (p != NULL)
 		memset (p, 0, size);
 
@@ -166,11 +170,11 @@ calloc (size_t a, size_t b) {
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
 block_size (void *block) {
-	struct block *b = block;
-	struct arena *a = block_to_arena (b);
-	struct desc *d = a->desc;
+	void *base = block_base (block);
 
-	return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
+	if (kmem_owns (base))
+		return kmem_size (base) - TAG_SIZE;
+	return PGSIZE * block_to_arena (base)->page_cnt - pg_ofs (block);
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
@@ -185,7 +189,8 @@ realloc (void *old_block, size_t new_size) {
 		free (old_block);
 		return NULL;
 	} else {
-		void *new_block = malloc (new_size);
+		void *new_block = malloc_at (new_size,
+				(uintptr_t) __builtin_return_address (0));
 		if (old_block != NULL && new_block != NULL) {
 			size_t old_size = block_size (old_block);
 			size_t min_size = new_size < old_size ? new_size : old_size;
@@ -200,48 +205,24 @@ realloc (void *old_block, size_t new_size) {
    malloc(), calloc(), or realloc(). */
 void
 free (void *p) {
-	if (p != NULL) {
-		struct block *b = p;
-		struct arena *a = block_to_arena (b);
-		struct desc *d = a->desc;
-
-		if (d != NULL) {
-			/* It's a normal block.  We handle it here. */
-
-#ifndef NDEBUG
-			/* Clear the block to help detect use-after-free bugs. */
-			memset (b, 0xcc, d->block_size);
-#endif
-
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
-			}
-
-			lock_release (&d->lock);
-		} else {
-			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
-			return;
-		}
+	if (p == NULL)
+		return;
+
+	/* Objects of other caches than malloc()'s have no tag. */
+	if (is_tagged (p))
+		p = untag_block (p);
+	if (kmem_owns (p))
+		kmem_free (p);
+	else {
+		/* It's a big block.  Free its pages. */
+		struct arena *a = block_to_arena (p);
+		palloc_free_multiple (a, a->page_cnt);
 	}
 }
-
-/* Returns the arena that block B is inside. */
+
+/* Returns the arena of big block B. */
 static struct arena *
-block_to_arena (struct block *b) {
+block_to_arena (void *b) {
 	struct arena *a = pg_round_down (b);
 
 	/* Check that the arena is valid. */
@@ -249,20 +230,120 @@ block_to_arena (struct block *b) {
 	ASSERT (a->magic == ARENA_MAGIC);
 
 	/* Check that the block is properly aligned for the arena. */
-	ASSERT (a->desc == NULL
-			|| (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-	ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+	ASSERT (pg_ofs (b) == sizeof *a);
 
 	return a;
 }
 
-/* Returns the (IDX - 1)'th block within arena A. */
-static struct block *
-arena_to_block (struct arena *a, size_t idx) {
-	ASSERT (a != NULL);
-	ASSERT (a->magic == ARENA_MAGIC);
-	ASSERT (idx < a->desc->blocks_per_arena);
-	return (struct block *) ((uint8_t *) a
-			+ sizeof *a
-			+ idx * a->desc->block_size);
+#ifdef MALLOC_PROFILE
+/* Records that BLOCK, of BYTES bytes, was allocated by the call at
+   CALLER, and returns the part of BLOCK after its tag. */
+static void *
+tag_block (void *block, size_t bytes, uintptr_t caller) {
+	struct malloc_tag *tag = block;
+	struct malloc_site *site = NULL;
+	enum intr_level old_level;
+	size_t i, h;
+
+	old_level = intr_disable ();
+	h = (caller * 0x9e3779b97f4a7c15ULL) >> 54;
+	for (i = 0; i < SITE_CNT; i++) {
+		struct malloc_site *s = &sites[(h + i) % SITE_CNT];
+		if (s->caller == caller || s->caller == 0) {
+			s->caller = caller;
+			site = s;
+			break;
+		}
+	}
+	if (site == NULL)
+		site = &other_site;
+
+	site->live_cnt++;
+	site->live_bytes += bytes;
+	if (site->live_bytes > site->peak_bytes)
+		site->peak_bytes = site->live_bytes;
+	site->allocs++;
+	intr_set_level (old_level);
+
+	tag->site = site;
+	tag->bytes = bytes;
+	return tag + 1;
+}
+
+/* Returns true if P was allocated by malloc(), calloc(), or
+   realloc(), and so has a tag, rather than taken from a cache of
+   its own. */
+static bool
+is_tagged (const void *p) {
+	struct kmem_cache *cache;
+	size_t i;
+
+	if (!kmem_owns (p))
+		return true;
+	cache = kmem_cache_of (p);
+	for (i = 0; i < CLASS_CNT; i++)
+		if (classes[i] == cache)
+			return true;
+	return false;
+}
+
+/* Charges the freeing of block P to the call site that allocated
+   it, and returns the start of P's tag. */
+static void *
+untag_block (void *p) {
+	struct malloc_tag *tag = block_base (p);
+	struct malloc_site *site = tag->site;
+	enum intr_level old_level;
+
+	ASSERT (site == &other_site
+			|| (site >= sites && site < sites + SITE_CNT));
+
+	old_level = intr_disable ();
+	ASSERT (site->live_cnt > 0 && site->live_bytes >= tag->bytes);
+	site->live_cnt--;
+	site->live_bytes -= tag->bytes;
+	intr_set_level (old_level);
+	return tag;
+}
+
+/* Prints the call sites that hold the most bytes. */
+void
+malloc_print_stats (void) {
+	static bool shown[SITE_CNT];
+	size_t live_cnt = 0, live_bytes = 0, site_cnt = 0;
+	size_t i, j;
+
+	for (i = 0; i < SITE_CNT; i++)
+		if (sites[i].caller != 0) {
+			live_cnt += sites[i].live_cnt;
+			live_bytes += sites[i].live_bytes;
+			site_cnt++;
+		}
+	live_cnt += other_site.live_cnt;
+	live_bytes += other_site.live_bytes;
+	printf ("Malloc: %zu bytes in %zu blocks held by %zu call sites\n",
+			live_bytes, live_cnt, site_cnt);
+	if (other_site.allocs > 0)
+		printf ("  %lld allocations from untracked call sites\n",
+				other_site.allocs);
+
+	/* Select the 16 largest sites, one at a time. */
+	for (j = 0; j < 16; j++) {
+		struct malloc_site *top = NULL;
+
+		for (i = 0; i < SITE_CNT; i++)
+			if (!shown[i] && sites[i].live_cnt > 0
+					&& (top == NULL || sites[i].live_bytes > top->live_bytes))
+				top = &sites[i];
+		if (top == NULL)
+			break;
+		shown[top - sites] = true;
+		printf ("  %#018llx: %zu bytes in %zu blocks, peak %zu bytes, "
+				"%lld allocations\n", (unsigned long long) top->caller,
+				top->live_bytes, top->live_cnt, top->peak_bytes, top->allocs);
+	}
+	if (j > 0)
+		printf ("Run `backtrace' on these addresses in the build directory "
+				"to find the call sites.\n");
 }
+#endif /* MALLOC_PROFILE */
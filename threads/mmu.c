@@ -6,6 +6,7 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
+#include "threads/tlb.h"
 #include "intrinsic.h"
 
 static uint64_t *
@@ -13,6 +14,8 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		if ((uint64_t) pte & PTE_PS)
+			return &pdp[idx];
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -35,6 +38,8 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 	int allocated = 0;
 	if (pdpe) {
 		uint64_t *pde = (uint64_t *) pdpe[idx];
+		if ((uint64_t) pde & PTE_PS)
+			return &pdpe[idx];
 		if (!((uint64_t) pde & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -60,7 +65,9 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR lies in a large page, returns its PDE or PDPE, which
+ * has PTE_PS set, whatever CREATE is. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -88,6 +95,80 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the page table at index IDX of table T, creating it if
+ * it does not exist.  Returns a null pointer if memory allocation
+ * fails. */
+static uint64_t *
+table_get (uint64_t *t, int idx) {
+	if (!(t[idx] & PTE_P)) {
+		uint64_t *new_page = palloc_get_page (PAL_ZERO);
+		if (new_page == NULL)
+			return NULL;
+		t[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	ASSERT (!(t[idx] & PTE_PS));
+	return ptov (PTE_ADDR (t[idx]));
+}
+
+/* Maps the 2 MiB page at virtual address VA in PML4 to physical
+ * address PA, with permission bits PERM.  VA and PA must be
+ * 2 MiB-aligned and VA must not be mapped already.  Returns true
+ * if successful, false if memory allocation failed. */
+bool
+pml4_set_large_page (uint64_t *pml4, uint64_t va, uint64_t pa, int perm) {
+	uint64_t *pdpe, *pd;
+
+	ASSERT (va % LARGE_PGSIZE == 0);
+	ASSERT (pa % LARGE_PGSIZE == 0);
+
+	pdpe = table_get (pml4, PML4 (va));
+	pd = pdpe != NULL ? table_get (pdpe, PDPE (va)) : NULL;
+	if (pd == NULL)
+		return false;
+	ASSERT (!(pd[PDX (va)] & PTE_P));
+	pd[PDX (va)] = pa | perm | PTE_PS;
+	return true;
+}
+
+/* Returns the size of the page that maps VA in PML4, whose entry
+ * PTE was returned by pml4e_walk(). */
+static uint64_t
+page_size (uint64_t *pml4, uint64_t va, const uint64_t *pte) {
+	uint64_t *pdpe;
+
+	if (!(*pte & PTE_PS))
+		return PGSIZE;
+	pdpe = ptov (PTE_ADDR (pml4[PML4 (va)]));
+	return pte == &pdpe[PDPE (va)] ? HUGE_PGSIZE : LARGE_PGSIZE;
+}
+
+/* Replaces the 2 MiB page that maps VA in PML4 by a page table of
+ * 4 kB pages that map the same memory with the same permissions,
+ * so that one of them can be changed alone.  Does nothing if VA
+ * is not mapped by a 2 MiB page.  The caller must invalidate the
+ * TLB entries of the old page.  Returns false if memory
+ * allocation failed. */
+bool
+pml4_split_large_page (uint64_t *pml4, uint64_t va) {
+	uint64_t *pde = pml4e_walk (pml4, va, false);
+	uint64_t *pt, pa, perm;
+	size_t i;
+
+	if (pde == NULL || !(*pde & PTE_PS))
+		return true;
+	ASSERT (page_size (pml4, va, pde) == LARGE_PGSIZE);
+
+	pt = palloc_get_page (0);
+	if (pt == NULL)
+		return false;
+	pa = PTE_ADDR (*pde) & ~(LARGE_PGSIZE - 1);
+	perm = *pde & (PGMASK & ~PTE_PS);
+	for (i = 0; i < PGSIZE / sizeof *pt; i++)
+		pt[i] = (pa + i * PGSIZE) | perm;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	return true;
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,7 +203,13 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (((uint64_t) pte) & PTE_P && pdp[i] & PTE_PS) {
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))
+				return false;
+		} else if (((uint64_t) pte) & PTE_P)
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
@@ -135,7 +222,12 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pde) & PTE_P)
+		if (((uint64_t) pde) & PTE_P && pdp[i] & PTE_PS) {
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) i << PDPESHIFT));
+			if (!func (&pdp[i], va, aux))
+				return false;
+		} else if (((uint64_t) pde) & PTE_P)
 			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
 					 aux, pml4_index, i))
 				return false;
@@ -143,7 +235,9 @@ pdp_for_each (uint64_t *pdp,
 	return true;
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries including kernel's.
+ * For a large page, FUNC gets its PDE or PDPE, with PTE_PS set,
+ * and the page's first address. */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
@@ -196,14 +290,15 @@ pml4_destroy (uint64_t *pml4) {
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
 		pdpe_destroy ((void *) PTE_ADDR (pdpe));
+	tlb_release (pml4);
 	palloc_free_page ((void *) pml4);
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  See threads/tlb.h for what happens to the TLB. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	tlb_activate (pml4 ? pml4 : base_pml4);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -216,8 +311,11 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	if (pte && (*pte & PTE_P)) {
+		uint64_t size = page_size (pml4, (uint64_t) uaddr, pte);
+		return ptov (PTE_ADDR (*pte) & ~(size - 1))
+			+ ((uint64_t) uaddr & (size - 1));
+	}
 	return NULL;
 }
 
@@ -257,8 +355,25 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_invalidate_page (pml4, upage);
+	}
+}
+
+/* Like pml4_clear_page(), for user virtual page UPAGE in BATCH's
+ * page map level 4, but leaves invalidating the TLB entry to
+ * tlb_batch_flush(), so that unmapping many pages costs one
+ * flush at most. */
+void
+pml4_clear_page_batch (struct tlb_batch *batch, void *upage) {
+	uint64_t *pte;
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	pte = pml4e_walk (batch->pml4, (uint64_t) upage, false);
+
+	if (pte != NULL && (*pte & PTE_P) != 0) {
+		*pte &= ~PTE_P;
+		tlb_batch_add (batch, upage);
 	}
 }
 
@@ -283,8 +398,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_invalidate_page (pml4, vpage);
 	}
 }
 
@@ -309,7 +423,6 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_invalidate_page (pml4, vpage);
 	}
 }
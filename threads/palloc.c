@@ -2,15 +2,19 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "intrinsic.h"
 
 /* Page allocator.  Hands out memory in page-size (or
    page-multiple) chunks.  See malloc.h for an allocator that
@@ -24,13 +28,62 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Free memory is kept as
+   blocks of 2**ORDER pages, aligned to their size relative to
+   the pool's base, on one free list per order.  A request is
+   rounded up to a power of 2, served from the smallest free
+   block that fits by splitting it in halves, and the pages past
+   the request are freed again right away.  A freed block merges
+   with its buddy, the other half of the block it was split from,
+   for as long as that is free too.  Both take O(log n) steps,
+   and the free lists live in the free pages themselves. */
+
+/* Number of block orders, from 1 page up to
+   2**(BUDDY_ORDERS - 1) pages. */
+#define BUDDY_ORDERS 20
+
+/* order_map[] value for pages that do not start a free block. */
+#define NOT_FREE 0xff
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
+	uint8_t *order_map;             /* Order of free block at each page. */
+	struct list free_lists[BUDDY_ORDERS]; /* Free blocks, by order. */
+	struct deferred_free *deferred; /* Frees waiting for the lock. */
 	uint8_t *base;                  /* Base of pool. */
+
+	/* Pages zeroed ahead of time by the idle thread, linked
+	   through their first word.  Allocated as far as the buddy
+	   allocator is concerned.  Protected by disabling
+	   interrupts, not by the lock, so that PAL_ZERO requests
+	   served from here never wait. */
+	void *zeroed;                   /* Top of the stack. */
+	size_t zeroed_cnt;              /* Number of pages on it. */
+	long long zero_hits;            /* PAL_ZERO pages taken from it. */
+	long long zero_misses;          /* PAL_ZERO pages zeroed on demand. */
+	long long prezeroed;            /* Pages zeroed by the idle thread. */
+	uint64_t prezero_cycles;        /* Cycles spent zeroing them. */
+};
+
+/* Most pages the idle thread keeps zeroed in each pool. */
+#define ZEROED_MAX 128
+
+/* Header of a free block, stored in its first page. */
+struct free_block {
+	struct list_elem elem;          /* Element in a free list. */
+};
+
+/* Pages freed with interrupts off, when taking the pool lock
+   could block, e.g. by do_schedule() for dead threads' stacks.
+   Stored in the first freed page; the next thread to take the
+   pool lock frees them. */
+struct deferred_free {
+	struct deferred_free *next;     /* Next deferred free. */
+	size_t page_cnt;                /* Number of pages. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,9 +92,20 @@ static struct pool kernel_pool, user_pool;
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
 static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
+init_pool (struct pool *p, const char *name, void **bm_base,
+		uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static size_t alloc_range (struct pool *, size_t page_cnt);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void pool_lock (struct pool *);
+static bool pool_try_lock (struct pool *);
+static void drain_deferred (struct pool *);
+static void release_range (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t alloc_pages (struct pool *, size_t page_cnt);
+static void *zeroed_get (struct pool *);
+static void *cache_get (struct pool *);
+static bool cache_put (struct pool *, void *page);
 
 /* multiboot info */
 struct multiboot_info {
@@ -158,7 +222,7 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 						break;
 					}
 					// generate kernel pool
-					init_pool (&kernel_pool,
+					init_pool (&kernel_pool, "kernel pool",
 							&free_start, region_start, start + rem * PGSIZE);
 					// Transition to the next state
 					if (rem == size_in_pg) {
@@ -188,7 +252,7 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 	}
 
 	// generate the user pool
-	init_pool(&user_pool, &free_start, region_start, end);
+	init_pool(&user_pool, "user pool", &free_start, region_start, end);
 
 	// Iterate over the e820_entry. Setup the usable.
 	uint64_t usable_bound = (uint64_t) free_start;
@@ -224,11 +288,13 @@ split:
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				free_range (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				free_range (pool, page_idx, page_cnt);
 			}
 		}
 	}
@@ -263,19 +329,36 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
 	void *pages;
 
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+	if (page_cnt == 1 && (flags & PAL_ZERO)) {
+		pages = zeroed_get (pool);
+		if (pages != NULL)
+			return pages;
+	}
+
+	if (page_cnt == 1)
+		pages = cache_get (pool);
+	else {
+		pool_lock (pool);
+		size_t page_idx = alloc_pages (pool, page_cnt);
+		lock_release (&pool->lock);
+
+		if (page_idx != BITMAP_ERROR)
+			pages = pool->base + PGSIZE * page_idx;
+		else
+			pages = NULL;
+	}
 
 	if (pages) {
-		if (flags & PAL_ZERO)
+		if (flags & PAL_ZERO) {
+			enum intr_level old_level;
+
 			memset (pages, 0, PGSIZE * page_cnt);
+			old_level = intr_disable ();
+			pool->zero_misses += page_cnt;
+			intr_set_level (old_level);
+		}
 	} else {
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
@@ -318,8 +401,23 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
-	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	if (page_cnt == 1 && cache_put (pool, pages))
+		return;
+
+	/* The lock could block, which do_schedule() must not, so
+	   leave these pages to the next thread that takes it. */
+	if (intr_get_level () == INTR_OFF) {
+		struct deferred_free *d = pages;
+
+		d->page_cnt = page_cnt;
+		d->next = pool->deferred;
+		pool->deferred = d;
+		return;
+	}
+
+	pool_lock (pool);
+	release_range (pool, page_idx, page_cnt);
+	lock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -328,23 +426,431 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END */
+/* Returns CPU's cache of pages from POOL. */
+static struct palloc_cache *
+cpu_cache (struct cpu *cpu, const struct pool *pool) {
+	return &cpu->palloc_caches[pool == &kernel_pool ? 0 : 1];
+}
+
+/* Returns the running CPU's cache of pages from POOL.  Interrupts
+   must be off, so that the thread cannot move to another CPU. */
+static struct palloc_cache *
+pool_cache (const struct pool *pool) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	return cpu_cache (cpu_current (), pool);
+}
+
+/* Acquires POOL's lock, then frees the pages whose freeing was
+   deferred. */
+static void
+pool_lock (struct pool *pool) {
+	lock_acquire (&pool->lock);
+	drain_deferred (pool);
+}
+
+/* Acquires POOL's lock if it is free, then frees the pages whose
+   freeing was deferred.  Returns false, without waiting, if
+   another thread holds it. */
+static bool
+pool_try_lock (struct pool *pool) {
+	if (!lock_try_acquire (&pool->lock))
+		return false;
+	drain_deferred (pool);
+	return true;
+}
+
+/* Frees the pages that palloc_free_multiple() could not free
+   because interrupts were off.  The pool lock must be held. */
+static void
+drain_deferred (struct pool *pool) {
+	struct deferred_free *d;
+	enum intr_level old_level;
+
+	ASSERT (lock_held_by_current_thread (&pool->lock));
+
+	old_level = intr_disable ();
+	d = pool->deferred;
+	pool->deferred = NULL;
+	intr_set_level (old_level);
+
+	while (d != NULL) {
+		struct deferred_free *next = d->next;
+		release_range (pool, pg_no (d) - pg_no (pool->base), d->page_cnt);
+		d = next;
+	}
+}
+
+/* Takes PAGE_CNT contiguous pages from POOL and marks them
+   allocated.  If no free block is large enough, gives back the
+   pages zeroed ahead of time and tries again.  Returns the index
+   of the first page, or BITMAP_ERROR on failure.  The pool lock
+   must be held. */
+static size_t
+alloc_pages (struct pool *pool, size_t page_cnt) {
+	size_t page_idx = alloc_range (pool, page_cnt);
+
+	if (page_idx == BITMAP_ERROR && pool->zeroed != NULL) {
+		enum intr_level old_level = intr_disable ();
+		void *page = pool->zeroed;
+		pool->zeroed = NULL;
+		pool->zeroed_cnt = 0;
+		intr_set_level (old_level);
+
+		while (page != NULL) {
+			void *next = *(void **) page;
+			release_range (pool, pg_no (page) - pg_no (pool->base), 1);
+			page = next;
+		}
+		page_idx = alloc_range (pool, page_cnt);
+	}
+
+	if (page_idx != BITMAP_ERROR) {
+		ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+		bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+	}
+	return page_idx;
+}
+
+/* Returns a page from POOL that the idle thread zeroed, or a
+   null pointer if there is none. */
+static void *
+zeroed_get (struct pool *pool) {
+	enum intr_level old_level = intr_disable ();
+	void *page = pool->zeroed;
+
+	if (page != NULL) {
+		pool->zeroed = *(void **) page;
+		pool->zeroed_cnt--;
+		pool->zero_hits++;
+	}
+	intr_set_level (old_level);
+
+	if (page != NULL)
+		*(void **) page = NULL;
+	return page;
+}
+
+/* Zeroes one free page ahead of time for PAL_ZERO requests, in
+   the first pool that has fewer than ZEROED_MAX zeroed pages.
+   Called by the idle thread, so it never waits for a pool lock.
+   Returns false if there was nothing to do or the pool was
+   busy. */
+bool
+palloc_prezero (void) {
+	struct pool *pool;
+	enum intr_level old_level;
+	uint64_t start;
+	size_t page_idx;
+	void *page;
+
+	if (kernel_pool.zeroed_cnt < ZEROED_MAX)
+		pool = &kernel_pool;
+	else if (user_pool.zeroed_cnt < ZEROED_MAX)
+		pool = &user_pool;
+	else
+		return false;
+
+	if (!pool_try_lock (pool))
+		return false;
+	page_idx = alloc_range (pool, 1);
+	if (page_idx != BITMAP_ERROR)
+		bitmap_mark (pool->used_map, page_idx);
+	lock_release (&pool->lock);
+	if (page_idx == BITMAP_ERROR)
+		return false;
+
+	page = pool->base + PGSIZE * page_idx;
+	start = rdtsc ();
+	memset (page, 0, PGSIZE);
+	pool->prezero_cycles += rdtsc () - start;
+
+	old_level = intr_disable ();
+	*(void **) page = pool->zeroed;
+	pool->zeroed = page;
+	pool->zeroed_cnt++;
+	pool->prezeroed++;
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Marks the PAGE_CNT allocated pages at PAGE_IDX in POOL free.
+   The pool lock must be held. */
+static void
+release_range (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	ASSERT (lock_held_by_current_thread (&pool->lock));
+	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	free_range (pool, page_idx, page_cnt);
+}
+
+/* Gives the CNT single pages in PAGES back to POOL. */
+static void
+free_pages (struct pool *pool, void **pages, size_t cnt) {
+	size_t i;
+
+	pool_lock (pool);
+	for (i = 0; i < cnt; i++)
+		release_range (pool, pg_no (pages[i]) - pg_no (pool->base), 1);
+	lock_release (&pool->lock);
+}
+
+/* Returns a single page from this CPU's cache of POOL, refilling
+   the cache with PALLOC_CACHE_BATCH pages from POOL if it is empty.
+   Returns a null pointer if POOL is out of pages.  Only this
+   CPU's cache is refilled, so pages cached by other CPUs are not
+   found; with only the bootstrap processor running, there are
+   none. */
+static void *
+cache_get (struct pool *pool) {
+	void *batch[PALLOC_CACHE_BATCH];
+	struct palloc_cache *cache;
+	enum intr_level old_level;
+	void *page = NULL;
+	size_t cnt, i;
+
+	old_level = intr_disable ();
+	cache = pool_cache (pool);
+	if (cache->cnt > 0) {
+		page = cache->pages[--cache->cnt];
+		cache->hits++;
+	}
+	intr_set_level (old_level);
+	if (page != NULL)
+		return page;
+
+	pool_lock (pool);
+	for (cnt = 0; cnt < PALLOC_CACHE_BATCH; cnt++) {
+		size_t page_idx = alloc_pages (pool, 1);
+		if (page_idx == BITMAP_ERROR)
+			break;
+		batch[cnt] = pool->base + PGSIZE * page_idx;
+	}
+	lock_release (&pool->lock);
+	if (cnt == 0)
+		return NULL;
+
+	/* Another thread may have refilled the cache in the
+	   meantime, so keep only what fits. */
+	old_level = intr_disable ();
+	cache = pool_cache (pool);
+	cache->refills++;
+	page = batch[--cnt];
+	for (i = 0; i < cnt && cache->cnt < PALLOC_CACHE_HIGH; i++)
+		cache->pages[cache->cnt++] = batch[i];
+	intr_set_level (old_level);
+	if (i < cnt)
+		free_pages (pool, batch + i, cnt - i);
+	return page;
+}
+
+/* Puts PAGE, a free page from POOL, in this CPU's cache of POOL.
+   If the cache is full, gives its oldest pages back to POOL
+   until PALLOC_CACHE_LOW are left.  Returns false, doing
+   nothing, if that is needed but interrupts are off. */
+static bool
+cache_put (struct pool *pool, void *page) {
+	void *batch[PALLOC_CACHE_HIGH - PALLOC_CACHE_LOW];
+	struct palloc_cache *cache;
+	enum intr_level old_level;
+	size_t cnt = 0;
+
+	old_level = intr_disable ();
+	cache = pool_cache (pool);
+	if (cache->cnt == PALLOC_CACHE_HIGH) {
+		if (old_level == INTR_OFF)
+			return false;
+		cnt = PALLOC_CACHE_HIGH - PALLOC_CACHE_LOW;
+		memcpy (batch, cache->pages, sizeof *batch * cnt);
+		memmove (cache->pages, cache->pages + cnt,
+				sizeof *cache->pages * PALLOC_CACHE_LOW);
+		cache->cnt = PALLOC_CACHE_LOW;
+		cache->drains++;
+	}
+	cache->pages[cache->cnt++] = page;
+	intr_set_level (old_level);
+	if (cnt > 0)
+		free_pages (pool, batch, cnt);
+	return true;
+}
+
+/* Prints the free memory of POOL and the hit rate of the CPUs'
+   caches in front of it. */
 static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+print_pool_stats (struct pool *pool) {
+	size_t free_pages = 0, blocks = 0, largest = 0, cached = 0;
+	long long hits = 0, refills = 0, drains = 0;
+	int order, i;
+
+	pool_lock (pool);
+	for (order = 0; order < BUDDY_ORDERS; order++) {
+		size_t cnt = list_size (&pool->free_lists[order]);
+		free_pages += cnt << order;
+		blocks += cnt;
+		if (cnt > 0)
+			largest = (size_t) 1 << order;
+	}
+	lock_release (&pool->lock);
+	printf ("%s: %zu of %zu pages free in %zu blocks, largest %zu pages\n",
+			pool->lock.name, free_pages, bitmap_size (pool->used_map),
+			blocks, largest);
+
+	for (i = 0; i < cpu_cnt; i++) {
+		struct palloc_cache *cache = cpu_cache (&cpus[i], pool);
+		cached += cache->cnt;
+		hits += cache->hits;
+		refills += cache->refills;
+		drains += cache->drains;
+	}
+	printf ("%s cache: %zu pages cached, %lld hits (%lld%%), "
+			"%lld refills, %lld drains\n", pool->lock.name, cached, hits,
+			hits + refills > 0 ? hits * 100 / (hits + refills) : 0,
+			refills, drains);
+
+	/* Each hit saved zeroing a page, which took the idle thread
+	   prezero_cycles / prezeroed cycles on average. */
+	printf ("%s zeroed: %zu pages ready, %lld hits (%lld%%), %lld misses, "
+			"%lld cycles saved\n", pool->lock.name, pool->zeroed_cnt,
+			pool->zero_hits,
+			pool->zero_hits + pool->zero_misses > 0
+			? pool->zero_hits * 100 / (pool->zero_hits + pool->zero_misses) : 0,
+			pool->zero_misses,
+			pool->prezeroed > 0
+			? (long long) (pool->prezero_cycles / pool->prezeroed) * pool->zero_hits
+			: 0);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	print_pool_stats (&kernel_pool);
+	print_pool_stats (&user_pool);
+}
+
+/* Initializes pool P, named NAME in lock statistics, as starting
+   at START and ending at END */
+static void
+init_pool (struct pool *p, const char *name, void **bm_base,
+		uint64_t start, uint64_t end) {
+  /* We'll put the pool's used_map and order_map at its base.
+     Calculate the space needed for them
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t om_pages = DIV_ROUND_UP (pgcnt, PGSIZE) * PGSIZE;
+	int order;
 
-	lock_init(&p->lock);
+	lock_init_adaptive (&p->lock);
+	lock_set_name (&p->lock, name);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	p->order_map = *bm_base + bm_pages;
 	p->base = (void *) start;
+	for (order = 0; order < BUDDY_ORDERS; order++)
+		list_init (&p->free_lists[order]);
+	p->deferred = NULL;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
+	memset (p->order_map, NOT_FREE, pgcnt);
+
+	*bm_base += bm_pages + om_pages;
+}
+
+/* Returns the free block header in page PAGE_IDX of POOL. */
+static struct free_block *
+block_at (const struct pool *pool, size_t page_idx) {
+	return (struct free_block *) (pool->base + page_idx * PGSIZE);
+}
+
+/* Returns the order of the smallest block that holds PAGE_CNT
+   pages. */
+static int
+block_order (size_t page_cnt) {
+	int order = 0;
+	while (order < BUDDY_ORDERS && ((size_t) 1 << order) < page_cnt)
+		order++;
+	return order;
+}
+
+/* Puts the block of 2**ORDER pages at PAGE_IDX on its free list. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order) {
+	pool->order_map[page_idx] = order;
+	list_push_front (&pool->free_lists[order],
+			&block_at (pool, page_idx)->elem);
+}
 
-	*bm_base += bm_pages;
+/* Takes the free block at PAGE_IDX off its free list. */
+static void
+remove_block (struct pool *pool, size_t page_idx) {
+	list_remove (&block_at (pool, page_idx)->elem);
+	pool->order_map[page_idx] = NOT_FREE;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX, merging it with
+   its buddy for as long as the buddy is free as a whole. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) {
+	size_t page_cnt = bitmap_size (pool->used_map);
+
+	while (order < BUDDY_ORDERS - 1) {
+		size_t buddy = page_idx ^ ((size_t) 1 << order);
+		if (buddy >= page_cnt || pool->order_map[buddy] != order)
+			break;
+		remove_block (pool, buddy);
+		page_idx &= ~((size_t) 1 << order);
+		order++;
+	}
+	push_block (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX in POOL, splitting them
+   into the largest aligned blocks they contain. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	while (page_cnt > 0) {
+		int order = 0;
+		while (order < BUDDY_ORDERS - 1
+				&& (page_idx & ((size_t) 1 << order)) == 0
+				&& ((size_t) 2 << order) <= page_cnt)
+			order++;
+		free_block (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Takes PAGE_CNT contiguous pages off POOL's free lists and
+   returns the index of the first, or BITMAP_ERROR if no free
+   block is large enough. */
+static size_t
+alloc_range (struct pool *pool, size_t page_cnt) {
+	int want = block_order (page_cnt);
+	int order;
+	struct free_block *block;
+	size_t page_idx;
+
+	if (page_cnt == 0 || want >= BUDDY_ORDERS)
+		return BITMAP_ERROR;
+	for (order = want; order < BUDDY_ORDERS; order++)
+		if (!list_empty (&pool->free_lists[order]))
+			break;
+	if (order == BUDDY_ORDERS)
+		return BITMAP_ERROR;
+
+	block = list_entry (list_front (&pool->free_lists[order]),
+			struct free_block, elem);
+	page_idx = ((uint8_t *) block - pool->base) / PGSIZE;
+	remove_block (pool, page_idx);
+
+	/* Split it down to the order we want, freeing the upper
+	   halves, then free the pages past PAGE_CNT. */
+	while (order > want) {
+		order--;
+		push_block (pool, page_idx + ((size_t) 1 << order), order);
+	}
+	if (((size_t) 1 << want) > page_cnt)
+		free_range (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+	return page_idx;
 }
 
 /* Returns true if PAGE was allocated from POOL,
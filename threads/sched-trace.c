@@ -0,0 +1,173 @@
+#include "threads/sched-trace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+#include "intrinsic.h"
+
+/* Number of context switches kept.  Must be a power of 2. */
+#define TRACE_SIZE 1024
+
+/* Why the thread switched from gave up the CPU. */
+enum switch_reason {
+	SWITCH_YIELD,               /* Still ready, e.g. preempted. */
+	SWITCH_BLOCK,               /* Blocked. */
+	SWITCH_EXIT                 /* Exited. */
+};
+
+static const char *reason_names[] = {"yield", "block", "exit"};
+
+/* One context switch. */
+struct trace_entry {
+	uint64_t tsc;               /* Time stamp counter at the switch. */
+	tid_t prev;                 /* Thread switched from. */
+	tid_t next;                 /* Thread switched to. */
+	uint8_t reason;             /* A switch_reason. */
+	uint8_t priority;           /* NEXT's priority. */
+};
+
+/* Ring buffer of the last TRACE_SIZE context switches.  Entry I
+   % TRACE_SIZE holds switch number I. */
+static struct trace_entry trace[TRACE_SIZE];
+static uint64_t trace_cnt;      /* Switches so far. */
+
+/* Run-queue latency histograms.  Bucket 0 counts waits shorter
+   than 2**HIST_SHIFT cycles, and bucket B > 0 those from
+   2**(HIST_SHIFT + B - 1) up to 2**(HIST_SHIFT + B) cycles; the
+   last bucket also counts everything longer. */
+#define HIST_SHIFT 10
+#define HIST_BUCKETS 24
+
+/* Run-queue latency histogram of one thread. */
+struct sched_hist {
+	tid_t tid;                  /* Thread, or TID_ERROR for many. */
+	char name[16];              /* Thread name. */
+	uint32_t waits[HIST_BUCKETS]; /* Number of waits, per bucket. */
+};
+
+/* The first HIST_CNT - 1 threads to wait on the run queue get a
+   histogram of their own, which outlives them.  Later threads
+   share the last one. */
+#define HIST_CNT 64
+static struct sched_hist hists[HIST_CNT];
+static int hist_cnt;
+
+bool sched_trace_at_power_off;
+
+static void hist_add (struct thread *, uint64_t cycles);
+
+/* Notes that T is about to be put on the run queue, for its
+   run-queue latency. */
+void
+sched_trace_ready (struct thread *t) {
+	t->ready_tsc = rdtsc ();
+}
+
+/* Logs a context switch from PREV to NEXT, charging NEXT's time
+   on the run queue, if any, to its histogram.  Called by
+   schedule() with interrupts off. */
+void
+sched_trace_switch (struct thread *prev, struct thread *next) {
+	uint64_t now = rdtsc ();
+	struct trace_entry *e = &trace[trace_cnt++ % TRACE_SIZE];
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	e->tsc = now;
+	e->prev = prev->tid;
+	e->next = next->tid;
+	e->reason = (prev->status == THREAD_READY ? SWITCH_YIELD
+			: prev->status == THREAD_BLOCKED ? SWITCH_BLOCK
+			: SWITCH_EXIT);
+	e->priority = next->priority;
+
+	if (next->ready_tsc != 0) {
+		hist_add (next, now - next->ready_tsc);
+		next->ready_tsc = 0;
+	}
+}
+
+/* Prints the logged context switches, oldest first, then the
+   run-queue latency histograms. */
+void
+sched_trace_dump (void) {
+	enum intr_level old_level;
+	uint64_t cnt, i;
+	int h;
+
+	old_level = intr_disable ();
+	cnt = trace_cnt;
+	intr_set_level (old_level);
+
+	i = cnt > TRACE_SIZE ? cnt - TRACE_SIZE : 0;
+	printf ("Sched trace: %"PRIu64" switches, last %"PRIu64":\n",
+			cnt, cnt - i);
+	for (; i < cnt; i++) {
+		struct trace_entry e;
+		bool overwritten;
+
+		/* Copy the entry out, unless switches since we started
+		   have already overwritten it. */
+		old_level = intr_disable ();
+		overwritten = trace_cnt > i + TRACE_SIZE;
+		e = trace[i % TRACE_SIZE];
+		intr_set_level (old_level);
+
+		if (!overwritten)
+			printf ("  %"PRIu64": %d -> %d, %s, priority %d\n",
+					e.tsc, e.prev, e.next, reason_names[e.reason], e.priority);
+	}
+
+	printf ("Run-queue latency, as \"<2^N cycles: waits\":\n");
+	for (h = 0; h < hist_cnt; h++) {
+		const struct sched_hist *hist = &hists[h];
+		int b;
+
+		if (hist->tid != TID_ERROR)
+			printf ("  %d %s:", hist->tid, hist->name);
+		else
+			printf ("  %s:", hist->name);
+		for (b = 0; b < HIST_BUCKETS; b++)
+			if (hist->waits[b] != 0) {
+				if (b < HIST_BUCKETS - 1)
+					printf (" <2^%d: %"PRIu32, HIST_SHIFT + b, hist->waits[b]);
+				else
+					printf (" more: %"PRIu32, hist->waits[b]);
+			}
+		printf ("\n");
+	}
+}
+
+/* Adds a run-queue wait of CYCLES to T's histogram, giving T a
+   histogram first if it has none. */
+static void
+hist_add (struct thread *t, uint64_t cycles) {
+	struct sched_hist *hist = t->sched_hist;
+	int b;
+
+	if (hist == NULL) {
+		if (hist_cnt < HIST_CNT - 1) {
+			hist = &hists[hist_cnt++];
+			hist->tid = t->tid;
+			strlcpy (hist->name, t->name, sizeof hist->name);
+		} else {
+			hist = &hists[HIST_CNT - 1];
+			if (hist_cnt < HIST_CNT) {
+				hist_cnt++;
+				hist->tid = TID_ERROR;
+				strlcpy (hist->name, "(others)", sizeof hist->name);
+			}
+		}
+		t->sched_hist = hist;
+	}
+
+	b = 0;
+	if (cycles >= 1u << HIST_SHIFT)
+		b = 64 - __builtin_clzll (cycles) - HIST_SHIFT;
+	if (b >= HIST_BUCKETS)
+		b = HIST_BUCKETS - 1;
+	hist->waits[b]++;
+}
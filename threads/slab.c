@@ -0,0 +1,556 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Maximum number of caches. */
+#define KMEM_CACHE_MAX 32
+
+/* Number of objects a magazine holds. */
+#define MAG_ROUNDS 15
+
+/* Most full magazines a cache's depot keeps.  The objects of any
+   more go back to their slabs. */
+#define DEPOT_MAX 8
+
+/* A magazine: a stack of free objects of one cache. */
+struct magazine {
+	struct magazine *next;      /* Next magazine in a depot list. */
+	size_t rounds;              /* Number of objects held. */
+	void *objs[MAG_ROUNDS];     /* The objects. */
+};
+
+/* One CPU's magazines for one cache.  Only that CPU uses them,
+   with interrupts off, so they need no lock. */
+struct kmem_cpu {
+	struct magazine *loaded;    /* Used first. */
+	struct magazine *previous;  /* Swapped with LOADED. */
+	long long hits;             /* Requests served from them. */
+};
+
+/* A cache of objects of one size. */
+struct kmem_cache {
+	char name[24];              /* Name, also used for the lock. */
+	size_t obj_size;            /* Size requested by the creator. */
+	size_t size;                /* OBJ_SIZE rounded up to the alignment. */
+	size_t objs_per_slab;       /* Number of objects in a slab. */
+	size_t offset;              /* Offset of the first object in a slab. */
+	kmem_ctor_func *ctor;       /* Constructor, or null. */
+	bool magazines;             /* Use the magazine layer? */
+	struct kmem_cpu cpus[CPU_MAX]; /* Per-CPU magazines. */
+
+	struct lock lock;           /* Protects the rest. */
+	struct magazine *depot_full; /* Depot of full magazines. */
+	struct magazine *depot_empty; /* Depot of empty magazines. */
+	size_t depot_full_cnt;      /* Number of magazines in DEPOT_FULL. */
+	long long misses;           /* Requests that took the lock. */
+	struct list partial;        /* Slabs with free and used objects. */
+	struct list full;           /* Slabs without free objects. */
+	struct list empty;          /* Slabs without used objects. */
+	size_t slab_cnt;            /* Number of slabs on all three lists. */
+	size_t in_use;              /* Number of objects allocated. */
+	long long allocs;           /* Number of objects taken from slabs. */
+	long long slabs_freed;      /* Number of slabs given back. */
+};
+
+/* A slab, stored at the start of its page and followed by the
+   cache's objects. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* In one of the cache's lists. */
+	size_t in_use;              /* Number of objects allocated. */
+	size_t free_cnt;            /* Number of entries in free_idx[]. */
+	uint16_t free_idx[];        /* Stack of free objects' indexes. */
+};
+
+static struct kmem_cache caches[KMEM_CACHE_MAX];
+static size_t cache_cnt;
+static struct lock caches_lock;
+
+/* Cache of the magazines themselves, which has none. */
+static struct kmem_cache *magazine_cache;
+
+static struct kmem_cache *cache_create (const char *name, size_t size,
+		size_t align, kmem_ctor_func *, bool magazines);
+static size_t objs_offset (size_t objs, size_t align);
+static struct slab *obj_to_slab (const void *);
+static void *slab_alloc (struct kmem_cache *);
+static void slab_free (struct kmem_cache *, void *);
+static void *mag_pop (struct kmem_cpu *);
+static bool mag_push (struct kmem_cpu *, void *);
+static void *mag_alloc (struct kmem_cache *);
+static void *depot_alloc (struct kmem_cache *);
+static bool mag_free (struct kmem_cache *, void *);
+static bool depot_free (struct kmem_cache *, void *);
+
+/* Creates and returns a cache of objects of SIZE bytes each,
+   aligned on ALIGN bytes, which must be a power of 2, or on a
+   pointer if ALIGN is 0.  CTOR, if nonnull, initializes each
+   object when its slab is created.  NAME identifies the cache
+   in statistics.  Caches are never destroyed.
+
+   Each CPU caches free objects of the new cache in a pair of
+   magazines, so that most kmem_cache_alloc() and
+   kmem_cache_free() calls take no lock.  When both are empty or
+   both are full, it trades one with the cache's depot of full
+   and empty magazines, under the cache's lock, and only falls
+   back to the slabs when the depot cannot help. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+		kmem_ctor_func *ctor) {
+	if (magazine_cache == NULL)
+		magazine_cache = cache_create ("magazine", sizeof (struct magazine),
+				0, NULL, false);
+	return cache_create (name, size, align, ctor, true);
+}
+
+/* Creates and returns a cache as described for
+   kmem_cache_create(), with the magazine layer if MAGAZINES is
+   true. */
+static struct kmem_cache *
+cache_create (const char *name, size_t size, size_t align,
+		kmem_ctor_func *ctor, bool magazines) {
+	struct kmem_cache *c;
+	size_t objs;
+
+	if (align == 0)
+		align = sizeof (void *);
+	ASSERT ((align & (align - 1)) == 0);
+	ASSERT (size > 0);
+
+	if (cache_cnt == 0)
+		lock_init (&caches_lock);
+	lock_acquire (&caches_lock);
+	if (cache_cnt >= KMEM_CACHE_MAX)
+		PANIC ("kmem_cache_create: too many caches");
+	c = &caches[cache_cnt++];
+	lock_release (&caches_lock);
+
+	strlcpy (c->name, name, sizeof c->name);
+	c->obj_size = size;
+	c->size = ROUND_UP (size, align);
+	c->ctor = ctor;
+	c->magazines = magazines;
+
+	/* Fit as many objects in a page as possible, along with the
+	   slab header and its stack of free indexes. */
+	objs = (PGSIZE - sizeof (struct slab)) / (c->size + sizeof (uint16_t));
+	while (objs > 0 && objs_offset (objs, align) + objs * c->size > PGSIZE)
+		objs--;
+	ASSERT (objs >= 2);
+	c->objs_per_slab = objs;
+	c->offset = objs_offset (objs, align);
+
+	lock_init_adaptive (&c->lock);
+	lock_set_name (&c->lock, c->name);
+	list_init (&c->partial);
+	list_init (&c->full);
+	list_init (&c->empty);
+	return c;
+}
+
+/* Returns the size of the objects in cache C. */
+size_t
+kmem_cache_size (const struct kmem_cache *c) {
+	return c->obj_size;
+}
+
+/* Returns the offset of the first of OBJS objects aligned on
+   ALIGN bytes in a slab. */
+static size_t
+objs_offset (size_t objs, size_t align) {
+	return ROUND_UP (sizeof (struct slab) + objs * sizeof (uint16_t), align);
+}
+
+/* Returns the IDX'th object in slab S. */
+static void *
+slab_obj (struct slab *s, size_t idx) {
+	return (uint8_t *) s + s->cache->offset + idx * s->cache->size;
+}
+
+/* Creates a new slab for cache C and puts it on C's empty list.
+   Returns false if no page is available. */
+static bool
+slab_create (struct kmem_cache *c) {
+	struct slab *s = palloc_get_page (0);
+	size_t i;
+
+	if (s == NULL)
+		return false;
+
+	s->magic = SLAB_MAGIC;
+	s->cache = c;
+	s->in_use = 0;
+	s->free_cnt = c->objs_per_slab;
+	for (i = 0; i < c->objs_per_slab; i++) {
+		/* Hand out low addresses first. */
+		s->free_idx[i] = c->objs_per_slab - 1 - i;
+		if (c->ctor != NULL)
+			c->ctor (slab_obj (s, i));
+	}
+	list_push_front (&c->empty, &s->elem);
+	c->slab_cnt++;
+	return true;
+}
+
+/* Allocates and returns an object from cache C, or a null pointer
+   if no memory is available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	void *obj;
+
+	if (c->magazines) {
+		obj = mag_alloc (c);
+		if (obj != NULL)
+			return obj;
+	}
+
+	lock_acquire (&c->lock);
+	c->misses++;
+	obj = c->magazines ? depot_alloc (c) : NULL;
+	if (obj == NULL)
+		obj = slab_alloc (c);
+	lock_release (&c->lock);
+	return obj;
+}
+
+/* Frees OBJ, which must have been allocated from cache C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	struct slab *s;
+	size_t ofs;
+
+	if (obj == NULL)
+		return;
+
+	s = obj_to_slab (obj);
+	ASSERT (s->cache == c);
+	ofs = (uint8_t *) obj - (uint8_t *) s - c->offset;
+	ASSERT (ofs % c->size == 0);
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs, unless
+	   it must stay constructed. */
+	if (c->ctor == NULL)
+		memset (obj, 0xcc, c->size);
+#endif
+
+	if (c->magazines && mag_free (c, obj))
+		return;
+
+	lock_acquire (&c->lock);
+	c->misses++;
+	if (!c->magazines || !depot_free (c, obj))
+		slab_free (c, obj);
+	lock_release (&c->lock);
+}
+
+/* Returns the running CPU's magazines for cache C.  Interrupts
+   must be off. */
+static struct kmem_cpu *
+cpu_mags (struct kmem_cache *c) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	return &c->cpus[cpu_current ()->id];
+}
+
+/* Pops an object off KC's magazines, swapping them if only the
+   previous one has any.  Returns a null pointer if both are
+   empty. */
+static void *
+mag_pop (struct kmem_cpu *kc) {
+	if ((kc->loaded == NULL || kc->loaded->rounds == 0)
+			&& kc->previous != NULL && kc->previous->rounds > 0) {
+		struct magazine *m = kc->loaded;
+		kc->loaded = kc->previous;
+		kc->previous = m;
+	}
+	if (kc->loaded == NULL || kc->loaded->rounds == 0)
+		return NULL;
+	return kc->loaded->objs[--kc->loaded->rounds];
+}
+
+/* Pushes OBJ onto KC's magazines, swapping them if only the
+   previous one has room.  Returns false if both are full or
+   missing. */
+static bool
+mag_push (struct kmem_cpu *kc, void *obj) {
+	if ((kc->loaded == NULL || kc->loaded->rounds == MAG_ROUNDS)
+			&& kc->previous != NULL && kc->previous->rounds < MAG_ROUNDS) {
+		struct magazine *m = kc->loaded;
+		kc->loaded = kc->previous;
+		kc->previous = m;
+	}
+	if (kc->loaded == NULL || kc->loaded->rounds == MAG_ROUNDS)
+		return false;
+	kc->loaded->objs[kc->loaded->rounds++] = obj;
+	return true;
+}
+
+/* Pops an object off this CPU's magazines for cache C, without
+   taking any lock.  Returns a null pointer if both are empty. */
+static void *
+mag_alloc (struct kmem_cache *c) {
+	enum intr_level old_level = intr_disable ();
+	struct kmem_cpu *kc = cpu_mags (c);
+	void *obj = mag_pop (kc);
+	if (obj != NULL)
+		kc->hits++;
+	intr_set_level (old_level);
+	return obj;
+}
+
+/* Called with C's lock held when both of this CPU's magazines are
+   empty.  Puts the previous one in the depot, and the loaded one
+   in its place, then loads a full magazine from the depot and
+   pops an object off it.  Returns a null pointer if the depot
+   has no full magazine. */
+static void *
+depot_alloc (struct kmem_cache *c) {
+	enum intr_level old_level = intr_disable ();
+	struct kmem_cpu *kc = cpu_mags (c);
+	struct magazine *full;
+	void *obj;
+
+	/* Another thread may have freed objects on this CPU while we
+	   waited for the lock. */
+	obj = mag_pop (kc);
+	if (obj == NULL && c->depot_full != NULL) {
+		full = c->depot_full;
+		c->depot_full = full->next;
+		c->depot_full_cnt--;
+		if (kc->previous != NULL) {
+			kc->previous->next = c->depot_empty;
+			c->depot_empty = kc->previous;
+		}
+		kc->previous = kc->loaded;
+		kc->loaded = full;
+		obj = mag_pop (kc);
+	}
+	intr_set_level (old_level);
+	return obj;
+}
+
+/* Pushes OBJ onto this CPU's magazines for cache C, without
+   taking any lock.  Returns false if both are full. */
+static bool
+mag_free (struct kmem_cache *c, void *obj) {
+	enum intr_level old_level = intr_disable ();
+	struct kmem_cpu *kc = cpu_mags (c);
+	bool done = mag_push (kc, obj);
+	if (done)
+		kc->hits++;
+	intr_set_level (old_level);
+	return done;
+}
+
+/* Called with C's lock held when both of this CPU's magazines are
+   full, or missing.  Puts the previous one in the depot, and the
+   loaded one in its place, then loads an empty magazine, taken
+   from the depot or newly allocated, and pushes OBJ onto it.
+   Returns false if no magazine is available. */
+static bool
+depot_free (struct kmem_cache *c, void *obj) {
+	struct magazine *empty, *flush = NULL;
+	enum intr_level old_level;
+	struct kmem_cpu *kc;
+	size_t i;
+
+	/* Allocating may block, so do it before turning interrupts
+	   off. */
+	empty = c->depot_empty;
+	if (empty != NULL)
+		c->depot_empty = empty->next;
+	else {
+		empty = kmem_cache_alloc (magazine_cache);
+		if (empty == NULL)
+			return false;
+	}
+	empty->rounds = 0;
+
+	old_level = intr_disable ();
+	kc = cpu_mags (c);
+	if (mag_push (kc, obj)) {
+		/* Another thread made room on this CPU while we waited
+		   for the lock or allocated. */
+		flush = empty;
+	} else {
+		if (kc->previous != NULL) {
+			if (c->depot_full_cnt < DEPOT_MAX) {
+				kc->previous->next = c->depot_full;
+				c->depot_full = kc->previous;
+				c->depot_full_cnt++;
+			} else
+				flush = kc->previous;
+		}
+		kc->previous = kc->loaded;
+		kc->loaded = empty;
+		mag_push (kc, obj);
+	}
+	intr_set_level (old_level);
+
+	/* Give FLUSH's objects, if any, back to their slabs and keep
+	   it as an empty magazine. */
+	if (flush != NULL) {
+		for (i = 0; i < flush->rounds; i++)
+			slab_free (c, flush->objs[i]);
+		flush->rounds = 0;
+		flush->next = c->depot_empty;
+		c->depot_empty = flush;
+	}
+	return true;
+}
+
+/* Allocates an object from one of cache C's slabs, creating a
+   slab if needed.  C's lock must be held. */
+static void *
+slab_alloc (struct kmem_cache *c) {
+	struct slab *s;
+	void *obj;
+
+	if (list_empty (&c->partial) && list_empty (&c->empty)
+			&& !slab_create (c))
+		return NULL;
+
+	if (!list_empty (&c->partial))
+		s = list_entry (list_front (&c->partial), struct slab, elem);
+	else {
+		s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+		list_push_front (&c->partial, &s->elem);
+	}
+
+	obj = slab_obj (s, s->free_idx[--s->free_cnt]);
+	s->in_use++;
+	if (s->free_cnt == 0) {
+		list_remove (&s->elem);
+		list_push_front (&c->full, &s->elem);
+	}
+	c->in_use++;
+	c->allocs++;
+	return obj;
+}
+
+/* Returns OBJ to its slab in cache C, giving the slab back to the
+   page allocator if it becomes empty and C already has an empty
+   slab.  C's lock must be held. */
+static void
+slab_free (struct kmem_cache *c, void *obj) {
+	struct slab *s = obj_to_slab (obj);
+	size_t ofs = (uint8_t *) obj - (uint8_t *) s - c->offset;
+
+	ASSERT (s->in_use > 0);
+	if (s->free_cnt == 0) {
+		list_remove (&s->elem);
+		list_push_front (&c->partial, &s->elem);
+	}
+	s->free_idx[s->free_cnt++] = ofs / c->size;
+	s->in_use--;
+	c->in_use--;
+
+	if (s->in_use == 0) {
+		list_remove (&s->elem);
+		if (list_empty (&c->empty))
+			list_push_front (&c->empty, &s->elem);
+		else {
+			c->slab_cnt--;
+			c->slabs_freed++;
+			s->magic = 0;
+			palloc_free_page (s);
+		}
+	}
+}
+
+/* Returns true if P is an object allocated from some cache. */
+bool
+kmem_owns (const void *p) {
+	const struct slab *s = pg_round_down (p);
+	return s->magic == SLAB_MAGIC;
+}
+
+/* Returns the cache that OBJ, an object allocated from any cache,
+   came from. */
+struct kmem_cache *
+kmem_cache_of (const void *obj) {
+	return obj_to_slab (obj)->cache;
+}
+
+/* Returns the size of OBJ, an object allocated from any cache. */
+size_t
+kmem_size (const void *obj) {
+	return obj_to_slab (obj)->cache->obj_size;
+}
+
+/* Frees OBJ, an object allocated from any cache. */
+void
+kmem_free (void *obj) {
+	kmem_cache_free (obj_to_slab (obj)->cache, obj);
+}
+
+/* Returns the slab that holds OBJ. */
+static struct slab *
+obj_to_slab (const void *obj) {
+	struct slab *s = pg_round_down (obj);
+
+	ASSERT (s != NULL);
+	ASSERT (s->magic == SLAB_MAGIC);
+	return s;
+}
+
+/* Prints the occupancy of each cache that has been used.  The
+   fragmentation is the part of the cache's pages not holding
+   requested bytes of live objects: slab headers, padding,
+   rounding and free objects. */
+void
+kmem_print_stats (void) {
+	size_t i;
+	int cpu;
+
+	printf ("Slab caches: name, object size, objects in use/total, "
+			"slabs partial/full/empty, fragmentation, "
+			"objects in magazines, lock-free requests\n");
+	for (i = 0; i < cache_cnt; i++) {
+		struct kmem_cache *c = &caches[i];
+		long long hits = 0;
+		size_t bytes, cached = 0;
+		struct magazine *m;
+		enum intr_level old_level;
+
+		if (c->allocs == 0)
+			continue;
+		lock_acquire (&c->lock);
+		old_level = intr_disable ();
+		for (cpu = 0; cpu < CPU_MAX; cpu++) {
+			struct kmem_cpu *kc = &c->cpus[cpu];
+			hits += kc->hits;
+			if (kc->loaded != NULL)
+				cached += kc->loaded->rounds;
+			if (kc->previous != NULL)
+				cached += kc->previous->rounds;
+		}
+		intr_set_level (old_level);
+		for (m = c->depot_full; m != NULL; m = m->next)
+			cached += m->rounds;
+
+		bytes = c->slab_cnt * PGSIZE;
+		printf ("  %-16s %5zu %6zu/%-6zu %4zu/%zu/%zu %3zu%% %5zu %3lld%%\n",
+				c->name, c->obj_size, c->in_use - cached,
+				c->slab_cnt * c->objs_per_slab,
+				list_size (&c->partial), list_size (&c->full),
+				list_size (&c->empty),
+				bytes > 0 ? 100 - c->in_use * c->obj_size * 100 / bytes : 0,
+				cached, hits + c->misses > 0
+				? hits * 100 / (hits + c->misses) : 0);
+		lock_release (&c->lock);
+	}
+}
@@ -29,8 +29,21 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timeout.h"
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
+
+/* Arrival counter that keeps waiters of equal priority in FIFO
+   order. */
+static uint64_t wait_seq;
+
+struct spinlock donation_lock;
+
+static void sema_wait (struct semaphore *);
+static bool sema_waiter_less (const struct heap_elem *,
+		const struct heap_elem *, void *aux);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -40,13 +53,19 @@
    decrement it.
 
    - up or "V": increment the value (and wake up one waiting
-   thread, if any). */
+   thread, if any).
+
+   Waiters are woken highest priority first, and in the order
+   they arrived among equal priorities.  A spinlock inside the
+   semaphore keeps its value and waiters consistent between
+   CPUs. */
 void
 sema_init (struct semaphore *sema, unsigned value) {
 	ASSERT (sema != NULL);
 
+	spin_lock_init (&sema->lock);
 	sema->value = value;
-	list_init (&sema->waiters);
+	heap_init (&sema->waiters, sema_waiter_less, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -59,18 +78,77 @@ sema_init (struct semaphore *sema, unsigned value) {
    sema_down function. */
 void
 sema_down (struct semaphore *sema) {
-	enum intr_level old_level;
+	ASSERT (sema != NULL);
+	ASSERT (!intr_context ());
+
+	spin_lock (&sema->lock);
+	while (sema->value == 0)
+		sema_wait (sema);
+	sema->value--;
+	spin_unlock (&sema->lock);
+}
+
+/* A thread waiting in sema_down_timeout(). */
+struct sema_waiter {
+	struct thread *thread;      /* Waiting thread. */
+	bool expired;               /* Has the timeout fired? */
+};
+
+/* Timeout callback for sema_down_timeout().  Takes the waiting
+   thread off the semaphore's waiters, unless sema_up() has
+   already done so, and wakes it up. */
+static void
+sema_timeout_expire (void *waiter_) {
+	struct sema_waiter *waiter = waiter_;
+	struct thread *t = waiter->thread;
+	struct semaphore *sema = t->waiting_sema;
+
+	waiter->expired = true;
+	if (sema == NULL)
+		return;
+
+	spin_lock (&sema->lock);
+	if (t->waiting_sema == sema) {
+		heap_remove (&sema->waiters, &t->sema_elem);
+		t->waiting_sema = NULL;
+		thread_unblock (t);
+	}
+	spin_unlock (&sema->lock);
+}
+
+/* Down or "P" operation on a semaphore that gives up after
+   TICKS timer ticks.  Returns true if SEMA was decremented,
+   false if the timeout expired first.  A TICKS value of 0 or
+   less makes this equivalent to sema_try_down().
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+sema_down_timeout (struct semaphore *sema, int64_t ticks) {
+	struct sema_waiter waiter;
+	struct timeout timeout;
+	bool success = false;
 
 	ASSERT (sema != NULL);
 	ASSERT (!intr_context ());
 
-	old_level = intr_disable ();
-	while (sema->value == 0) {
-		list_push_back (&sema->waiters, &thread_current ()->elem);
-		thread_block ();
+	spin_lock (&sema->lock);
+	if (sema->value == 0 && ticks > 0) {
+		waiter.thread = thread_current ();
+		waiter.expired = false;
+		timeout_init (&timeout, sema_timeout_expire, &waiter);
+		timeout_add (&timeout, ticks);
+		while (sema->value == 0 && !waiter.expired)
+			sema_wait (sema);
+		timeout_cancel (&timeout);
 	}
-	sema->value--;
-	intr_set_level (old_level);
+	if (sema->value > 0) {
+		sema->value--;
+		success = true;
+	}
+	spin_unlock (&sema->lock);
+
+	return success;
 }
 
 /* Down or "P" operation on a semaphore, but only if the
@@ -80,12 +158,11 @@ sema_down (struct semaphore *sema) {
    This function may be called from an interrupt handler. */
 bool
 sema_try_down (struct semaphore *sema) {
-	enum intr_level old_level;
 	bool success;
 
 	ASSERT (sema != NULL);
 
-	old_level = intr_disable ();
+	spin_lock (&sema->lock);
 	if (sema->value > 0)
 	{
 		sema->value--;
@@ -93,30 +170,86 @@ sema_try_down (struct semaphore *sema) {
 	}
 	else
 		success = false;
-	intr_set_level (old_level);
+	spin_unlock (&sema->lock);
 
 	return success;
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any, yielding to it if it outranks the current
+   thread.  The yield is put off while the caller has interrupts
+   disabled, so as not to break up its critical section.
 
    This function may be called from an interrupt handler. */
 void
 sema_up (struct semaphore *sema) {
-	enum intr_level old_level;
+	bool preempt;
 
 	ASSERT (sema != NULL);
 
-	old_level = intr_disable ();
-	if (!list_empty (&sema->waiters))
-		thread_unblock (list_entry (list_pop_front (&sema->waiters),
-					struct thread, elem));
+	spin_lock (&sema->lock);
+	if (!heap_empty (&sema->waiters)) {
+		struct thread *t = heap_entry (heap_pop (&sema->waiters),
+				struct thread, sema_elem);
+		t->waiting_sema = NULL;
+		thread_unblock (t);
+	}
 	sema->value++;
-	intr_set_level (old_level);
+	preempt = sema->lock.old_level == INTR_ON || intr_context ();
+	spin_unlock (&sema->lock);
+
+	if (preempt)
+		thread_preempt ();
+}
+
+/* Adds the current thread to SEMA's waiters and blocks it until
+   sema_up() or a timeout takes it off again.  SEMA's spinlock
+   must be held.  It is let go while the thread sleeps, but
+   interrupts stay off until thread_block() has switched away, so
+   that no interrupt handler on this CPU can wake the thread
+   before it sleeps.  That is only enough while the bootstrap
+   processor is the only CPU that schedules threads: another one
+   could wake the thread in between. */
+static void
+sema_wait (struct semaphore *sema) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level = sema->lock.old_level;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	curr->waiting_sema = sema;
+	curr->wait_seq = __atomic_fetch_add (&wait_seq, 1, __ATOMIC_RELAXED);
+	heap_push (&sema->waiters, &curr->sema_elem);
+	__atomic_store_n (&sema->lock.locked, 0, __ATOMIC_RELEASE);
+	thread_block ();
+	spin_lock (&sema->lock);
+	sema->lock.old_level = old_level;
+}
+
+/* Orders threads in a semaphore's waiters by priority, and by
+   arrival among equal priorities, so that the earliest arrival
+   compares greatest. */
+static bool
+sema_waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = heap_entry (a_, struct thread, sema_elem);
+	const struct thread *b = heap_entry (b_, struct thread, sema_elem);
+
+	if (a->priority != b->priority)
+		return a->priority < b->priority;
+	return a->wait_seq > b->wait_seq;
 }
 
 static void sema_test_helper (void *sema_);
+static bool donor_less (const struct heap_elem *, const struct heap_elem *,
+		void *aux);
+static bool lock_update_donation (struct lock *);
+static void propagate_donation (struct lock *);
+static bool reprioritize (struct thread *);
+static void lock_spin (struct lock *);
+static void lock_account (struct lock *, bool contended, bool blocked,
+		int64_t start);
 
 /* Self-test for semaphores that makes control "ping-pong"
    between a pair of threads.  Insert calls to printf() to see
@@ -151,6 +284,17 @@ sema_test_helper (void *sema_) {
 	}
 }
 
+/* Maximum depth of nested priority donation. */
+#define DONATION_DEPTH_MAX 8
+
+/* Maximum number of times an adaptive lock is polled before its
+   waiter blocks. */
+#define LOCK_SPIN_MAX 1000
+
+/* Locks reported by lock_print_stats(), most recently named
+   first. */
+static struct lock *named_locks;
+
 /* Initializes LOCK.  A lock can be held by at most a single
    thread at any given time.  Our locks are not "recursive", that
    is, it is an error for the thread currently holding a lock to
@@ -172,24 +316,165 @@ lock_init (struct lock *lock) {
 
 	lock->holder = NULL;
 	sema_init (&lock->semaphore, 1);
+	lock->adaptive = false;
+	heap_init (&lock->waiters, donor_less, NULL);
+	lock->max_priority = -1;
+	lock->name = NULL;
+	lock->next_named = NULL;
+	lock->acquires = lock->contended = lock->spun = 0;
+	lock->wait_ticks = 0;
+}
+
+/* Initializes LOCK as an adaptive lock, meant for critical
+   sections that are only a few instructions long.  A thread that
+   finds an adaptive lock held first spins for a while, as long as
+   the holder is running, and blocks only if the lock is still
+   held after that.  Otherwise it behaves like lock_init(). */
+void
+lock_init_adaptive (struct lock *lock) {
+	lock_init (lock);
+	lock->adaptive = true;
+}
+
+/* Names LOCK and adds it to the locks whose contention
+   statistics are reported by lock_print_stats().  NAME must stay
+   valid for as long as LOCK does, and LOCK must never be
+   destroyed. */
+void
+lock_set_name (struct lock *lock, const char *name) {
+	enum intr_level old_level;
+
+	ASSERT (lock != NULL);
+	ASSERT (name != NULL);
+
+	old_level = intr_disable ();
+	if (lock->name == NULL) {
+		lock->next_named = named_locks;
+		named_locks = lock;
+	}
+	lock->name = name;
+	intr_set_level (old_level);
+}
+
+/* Prints contention statistics for the named locks. */
+void
+lock_print_stats (void) {
+	struct lock *lock;
+
+	for (lock = named_locks; lock != NULL; lock = lock->next_named)
+		printf ("Lock %s: %lld acquires, %lld contended (%lld spun), "
+				"%lld wait ticks\n", lock->name, lock->acquires,
+				lock->contended, lock->spun, lock->wait_ticks);
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   While it waits, the current thread donates its priority to
+   the holder, and through it down the chain of locks the holder
+   is waiting for, at most DONATION_DEPTH_MAX levels deep.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
    we need to sleep. */
 void
 lock_acquire (struct lock *lock) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+	bool contended, blocked = false;
+	int64_t start = 0;
+
 	ASSERT (lock != NULL);
 	ASSERT (!intr_context ());
 	ASSERT (!lock_held_by_current_thread (lock));
 
+	contended = lock->semaphore.value == 0;
+	if (contended) {
+		start = timer_ticks ();
+		if (lock->adaptive)
+			lock_spin (lock);
+	}
+
+	old_level = intr_disable ();
+	if (lock->semaphore.value == 0) {
+		blocked = true;
+		if (!contended)
+			start = timer_ticks ();
+		if (!thread_mlfqs) {
+			spin_lock (&donation_lock);
+			curr->wait_on_lock = lock;
+			heap_push (&lock->waiters, &curr->donor_elem);
+			propagate_donation (lock);
+			spin_unlock (&donation_lock);
+		}
+	}
 	sema_down (&lock->semaphore);
-	lock->holder = thread_current ();
+	spin_lock (&donation_lock);
+	if (curr->wait_on_lock != NULL) {
+		heap_remove (&lock->waiters, &curr->donor_elem);
+		curr->wait_on_lock = NULL;
+	}
+	lock->holder = curr;
+	if (!thread_mlfqs)
+		lock_update_donation (lock);
+	spin_unlock (&donation_lock);
+	lock_account (lock, contended, blocked, start);
+	intr_set_level (old_level);
+}
+
+/* Acquires LOCK, sleeping for at most TICKS timer ticks until it
+   becomes available.  Returns true if the lock was acquired,
+   false if the timeout expired first.  The lock must not already
+   be held by the current thread.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+lock_acquire_timeout (struct lock *lock, int64_t ticks) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+	bool success, blocked;
+	int64_t start = 0;
+
+	ASSERT (lock != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (!lock_held_by_current_thread (lock));
+
+	old_level = intr_disable ();
+	blocked = lock->semaphore.value == 0 && ticks > 0;
+	if (blocked) {
+		start = timer_ticks ();
+		if (!thread_mlfqs) {
+			spin_lock (&donation_lock);
+			curr->wait_on_lock = lock;
+			heap_push (&lock->waiters, &curr->donor_elem);
+			propagate_donation (lock);
+			spin_unlock (&donation_lock);
+		}
+	}
+	success = sema_down_timeout (&lock->semaphore, ticks);
+	spin_lock (&donation_lock);
+	if (curr->wait_on_lock != NULL) {
+		heap_remove (&lock->waiters, &curr->donor_elem);
+		curr->wait_on_lock = NULL;
+
+		/* Take back what we donated to the holder. */
+		if (!success)
+			propagate_donation (lock);
+	}
+	if (success) {
+		lock->holder = curr;
+		if (!thread_mlfqs)
+			lock_update_donation (lock);
+	}
+	spin_unlock (&donation_lock);
+	if (success)
+		lock_account (lock, blocked, blocked, start);
+	intr_set_level (old_level);
+
+	return success;
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -205,9 +490,17 @@ lock_try_acquire (struct lock *lock) {
 	ASSERT (lock != NULL);
 	ASSERT (!lock_held_by_current_thread (lock));
 
+	enum intr_level old_level = intr_disable ();
 	success = sema_try_down (&lock->semaphore);
-	if (success)
+	if (success) {
+		spin_lock (&donation_lock);
 		lock->holder = thread_current ();
+		if (!thread_mlfqs)
+			lock_update_donation (lock);
+		spin_unlock (&donation_lock);
+		lock->acquires++;
+	}
+	intr_set_level (old_level);
 	return success;
 }
 
@@ -219,11 +512,26 @@ lock_try_acquire (struct lock *lock) {
    handler. */
 void
 lock_release (struct lock *lock) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+
 	ASSERT (lock != NULL);
 	ASSERT (lock_held_by_current_thread (lock));
 
+	old_level = intr_disable ();
+	spin_lock (&donation_lock);
+	if (lock->max_priority >= 0) {
+		/* Give up the priority donated through LOCK. */
+		heap_remove (&curr->held_locks, &lock->elem);
+		lock->max_priority = -1;
+		reprioritize (curr);
+	}
 	lock->holder = NULL;
+	spin_unlock (&donation_lock);
 	sema_up (&lock->semaphore);
+	intr_set_level (old_level);
+
+	thread_preempt ();
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -236,12 +544,126 @@ lock_held_by_current_thread (const struct lock *lock) {
 	return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
+/* Polls LOCK, at most LOCK_SPIN_MAX times, for as long as it is
+   held by a thread that is running, in the hope that it is
+   released before we have to block.  On a single CPU the holder
+   is never running while we are, so this returns at once. */
+static void
+lock_spin (struct lock *lock) {
+	int i;
+
+	for (i = 0; i < LOCK_SPIN_MAX && lock->semaphore.value == 0; i++) {
+		struct thread *holder = lock->holder;
+
+		if (holder != NULL && holder->status != THREAD_RUNNING)
+			break;
+		pause ();
+	}
+}
+
+/* Counts an acquisition of LOCK by the current thread, which
+   found it held if CONTENDED and had to block for it if BLOCKED,
+   and which started waiting at tick START.  Interrupts must be
+   off. */
+static void
+lock_account (struct lock *lock, bool contended, bool blocked,
+		int64_t start) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	lock->acquires++;
+	if (contended || blocked) {
+		lock->contended++;
+		if (!blocked)
+			lock->spun++;
+		lock->wait_ticks += timer_elapsed (start);
+	}
+}
+
+/* Orders threads in a lock's waiters by priority. */
+static bool
+donor_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = heap_entry (a_, struct thread, donor_elem);
+	const struct thread *b = heap_entry (b_, struct thread, donor_elem);
+
+	return a->priority < b->priority;
+}
+
+/* Brings the priority LOCK donates to its holder up to date with
+   LOCK's highest-priority waiter, and re-sorts LOCK among the
+   holder's held locks.  A lock without a holder donates nothing.
+   Returns true if the holder's effective priority changed.
+   donation_lock must be held. */
+static bool
+lock_update_donation (struct lock *lock) {
+	struct thread *holder = lock->holder;
+	int priority = -1;
+
+	ASSERT (donation_lock.locked);
+
+	if (holder != NULL && !heap_empty (&lock->waiters))
+		priority = heap_entry (heap_top (&lock->waiters),
+				struct thread, donor_elem)->priority;
+	if (priority == lock->max_priority)
+		return false;
+
+	if (lock->max_priority >= 0)
+		heap_remove (&holder->held_locks, &lock->elem);
+	lock->max_priority = priority;
+	if (priority >= 0)
+		heap_push (&holder->held_locks, &lock->elem);
+	return reprioritize (holder);
+}
+
+/* Updates the donation through LOCK and, for as long as that
+   changes a holder's priority, through the lock that holder is
+   waiting for, up to DONATION_DEPTH_MAX locks.  donation_lock
+   must be held. */
+static void
+propagate_donation (struct lock *lock) {
+	int depth;
+
+	for (depth = 0; lock != NULL && depth < DONATION_DEPTH_MAX; depth++) {
+		if (!lock_update_donation (lock))
+			break;
+		lock = lock->holder->wait_on_lock;
+	}
+}
+
+/* Recomputes T's effective priority from its base priority and
+   its held locks, keeping T in order in the waiters of the lock
+   it waits for, if any.  Returns true if the priority changed.
+   donation_lock must be held. */
+static bool
+reprioritize (struct thread *t) {
+	struct lock *lock = t->wait_on_lock;
+	int priority = thread_donated_priority (t);
+
+	if (priority == t->priority)
+		return false;
+
+	if (lock != NULL)
+		heap_remove (&lock->waiters, &t->donor_elem);
+	thread_change_priority (t, priority);
+	if (lock != NULL)
+		heap_push (&lock->waiters, &t->donor_elem);
+	return true;
+}
+
+/* One semaphore in a condition variable's waiters.  PRIORITY is
+   the waiting thread's priority when it started to wait; a
+   donation it receives afterward does not move it ahead. */
 struct semaphore_elem {
-	struct list_elem elem;              /* List element. */
+	struct heap_elem elem;              /* Heap element. */
 	struct semaphore semaphore;         /* This semaphore. */
+	int priority;                       /* Waiter's priority. */
+	uint64_t seq;                       /* Arrival order. */
 };
 
+static bool cond_waiter_less (const struct heap_elem *,
+		const struct heap_elem *, void *aux);
+static void cond_enqueue (struct condition *, struct semaphore_elem *);
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -249,7 +671,7 @@ void
 cond_init (struct condition *cond) {
 	ASSERT (cond != NULL);
 
-	list_init (&cond->waiters);
+	heap_init (&cond->waiters, cond_waiter_less, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -281,13 +703,45 @@ cond_wait (struct condition *cond, struct lock *lock) {
 	ASSERT (!intr_context ());
 	ASSERT (lock_held_by_current_thread (lock));
 
-	sema_init (&waiter.semaphore, 0);
-	list_push_back (&cond->waiters, &waiter.elem);
+	cond_enqueue (cond, &waiter);
 	lock_release (lock);
 	sema_down (&waiter.semaphore);
 	lock_acquire (lock);
 }
 
+/* Like cond_wait(), but gives up waiting after TICKS timer
+   ticks.  LOCK is reacquired before returning in either case.
+   Returns true if COND was signaled, false if the timeout
+   expired first.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+cond_wait_timeout (struct condition *cond, struct lock *lock, int64_t ticks) {
+	struct semaphore_elem waiter;
+	bool signaled;
+
+	ASSERT (cond != NULL);
+	ASSERT (lock != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (lock_held_by_current_thread (lock));
+
+	cond_enqueue (cond, &waiter);
+	lock_release (lock);
+	signaled = sema_down_timeout (&waiter.semaphore, ticks);
+	lock_acquire (lock);
+
+	/* cond_signal() runs under LOCK, so if the signal has not
+	   arrived by now, WAITER is still in COND's waiters. */
+	if (!signaled) {
+		if (sema_try_down (&waiter.semaphore))
+			signaled = true;
+		else
+			heap_remove (&cond->waiters, &waiter.elem);
+	}
+	return signaled;
+}
+
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -302,8 +756,8 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED) {
 	ASSERT (!intr_context ());
 	ASSERT (lock_held_by_current_thread (lock));
 
-	if (!list_empty (&cond->waiters))
-		sema_up (&list_entry (list_pop_front (&cond->waiters),
+	if (!heap_empty (&cond->waiters))
+		sema_up (&heap_entry (heap_pop (&cond->waiters),
 					struct semaphore_elem, elem)->semaphore);
 }
 
@@ -318,6 +772,179 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 	ASSERT (cond != NULL);
 	ASSERT (lock != NULL);
 
-	while (!list_empty (&cond->waiters))
+	while (!heap_empty (&cond->waiters))
 		cond_signal (cond, lock);
 }
+
+/* Initializes WAITER for the current thread and adds it to
+   COND's waiters. */
+static void
+cond_enqueue (struct condition *cond, struct semaphore_elem *waiter) {
+	sema_init (&waiter->semaphore, 0);
+	waiter->priority = thread_get_priority ();
+	waiter->seq = __atomic_fetch_add (&wait_seq, 1, __ATOMIC_RELAXED);
+	heap_push (&cond->waiters, &waiter->elem);
+}
+
+/* Orders a condition variable's waiters like sema_waiter_less()
+   does a semaphore's. */
+static bool
+cond_waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct semaphore_elem *a
+		= heap_entry (a_, struct semaphore_elem, elem);
+	const struct semaphore_elem *b
+		= heap_entry (b_, struct semaphore_elem, elem);
+
+	if (a->priority != b->priority)
+		return a->priority < b->priority;
+	return a->seq > b->seq;
+}
+
+/* Initializes readers-writer lock RW.  Any number of readers may
+   hold RW at once, or a single writer.
+
+   RW prefers writers: once a writer asks for RW, new readers
+   queue up behind it until it is done, so a steady stream of
+   readers cannot starve writers.  Queued readers and writers
+   take turns in priority order, and donate their priority to
+   the writer they wait for, through the ordinary lock that the
+   writer holds.  A writer waiting for the active readers to
+   leave does not donate to them, since there can be any number
+   of them. */
+void
+rwlock_init (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_init (&rw->writer);
+	rw->readers = 0;
+	rw->draining = false;
+	sema_init (&rw->drained, 0);
+}
+
+/* Acquires RW for reading, sleeping until no writer holds or
+   waits for it if necessary.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (!lock_held_by_current_thread (&rw->writer));
+
+	old_level = intr_disable ();
+	if (rw->writer.holder == NULL)
+		rw->readers++;
+	else {
+		/* Wait our turn behind the writer. */
+		lock_acquire (&rw->writer);
+		rw->readers++;
+		lock_release (&rw->writer);
+	}
+	intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for reading. */
+void
+rwlock_release_read (struct rwlock *rw) {
+	enum intr_level old_level;
+	bool wake_writer = false;
+
+	ASSERT (rw != NULL);
+	ASSERT (rw->readers > 0);
+
+	old_level = intr_disable ();
+	if (--rw->readers == 0 && rw->draining) {
+		rw->draining = false;
+		wake_writer = true;
+	}
+	intr_set_level (old_level);
+
+	/* With interrupts back on, so that sema_up() can yield to the
+	   writer. */
+	if (wake_writer)
+		sema_up (&rw->drained);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it if necessary.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+
+	/* Holding the lock keeps new readers out. */
+	lock_acquire (&rw->writer);
+
+	old_level = intr_disable ();
+	if (rw->readers > 0) {
+		rw->draining = true;
+		sema_down (&rw->drained);
+	}
+	intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void
+rwlock_release_write (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (rw->readers == 0);
+
+	lock_release (&rw->writer);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise. */
+bool
+rwlock_write_held_by_current_thread (const struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	return lock_held_by_current_thread (&rw->writer);
+}
+
+/* Initializes spinlock LOCK as released. */
+void
+spin_lock_init (struct spinlock *lock) {
+	ASSERT (lock != NULL);
+
+	lock->locked = 0;
+}
+
+/* Turns interrupts off and busy-waits until LOCK is free, then
+   takes it.  The interrupt level is restored by spin_unlock().
+
+   This function may be called from an interrupt handler. */
+void
+spin_lock (struct spinlock *lock) {
+	enum intr_level old_level;
+
+	ASSERT (lock != NULL);
+
+	old_level = intr_disable ();
+	while (__atomic_exchange_n (&lock->locked, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n (&lock->locked, __ATOMIC_RELAXED))
+			pause ();
+	lock->old_level = old_level;
+}
+
+/* Releases LOCK, which must be held, and restores the interrupt
+   level from before spin_lock(). */
+void
+spin_unlock (struct spinlock *lock) {
+	enum intr_level old_level;
+
+	ASSERT (lock != NULL);
+	ASSERT (lock->locked);
+
+	old_level = lock->old_level;
+	__atomic_store_n (&lock->locked, 0, __ATOMIC_RELEASE);
+	intr_set_level (old_level);
+}
@@ -4,12 +4,15 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/sched-trace.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -24,12 +27,25 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-
-/* Idle thread. */
-static struct thread *idle_thread;
+/* Each CPU has a run queue of processes in THREAD_READY state,
+   that is, processes that are ready to run but not actually
+   running.  There is one FIFO list per priority level, and bit P
+   of ready_bitmap is set iff ready_queues[P] is non-empty, so the
+   highest ready priority is found with a single bit scan.  The
+   run queue is protected by the CPU's spinlock.
+
+   Each CPU also has a wakeup stack of threads unblocked from
+   interrupt context, still in the THREAD_BLOCKED state, waiting
+   for the next schedule() to move them onto the run queue.
+   Interrupt handlers push onto this lock-free stack without
+   touching the run queue, and schedule() takes the whole stack
+   in one atomic exchange.
+
+   Each CPU runs its own idle thread when its run queue is
+   empty. */
+#if PRI_MAX - PRI_MIN >= 64
+#error ready_bitmap requires at most 64 priority levels
+#endif
 
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
@@ -40,20 +56,37 @@ static struct lock tid_lock;
 /* Thread destruction requests */
 static struct list destruction_req;
 
-/* Statistics. */
-static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
-
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+
+/* Load balancing.  A CPU about to go idle steals from the CPU
+   with the most ready threads, and every BALANCE_TICKS each CPU
+   also does so if it has at least BALANCE_IMBALANCE fewer ready
+   threads than the busiest one.  A steal moves half the
+   difference, lowest priority first, since those threads would
+   wait longest where they are. */
+#define BALANCE_TICKS 20        /* # of timer ticks between checks. */
+#define BALANCE_IMBALANCE 2     /* Difference worth a periodic steal. */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Multi-level feedback queue scheduler.
+
+   Only threads whose recent_cpu or nice is nonzero can change
+   priority when recent_cpu decays once a second; they are kept
+   on active_list, so the per-second pass skips threads that have
+   not run recently.  Between those passes only the running
+   thread's recent_cpu changes, so the priority update every
+   TIME_SLICE ticks covers just the threads that ran since the
+   last one, which are kept on dirty_list.  A new priority is
+   applied by moving the thread to another run queue bucket. */
+static fixed_t load_avg;        /* System load average. */
+static struct list active_list; /* Threads with nonzero recent_cpu or nice. */
+static struct list dirty_list;  /* Threads whose recent_cpu changed. */
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -62,6 +95,22 @@ static void init_thread (struct thread *, const char *name, int priority);
 static void do_schedule(int status);
 static void schedule (void);
 static tid_t allocate_tid (void);
+static void ready_queue_push (struct cpu *, struct thread *);
+static struct thread *ready_queue_pop (struct cpu *);
+static int ready_queue_max_priority (struct cpu *);
+static void ready_queue_remove (struct thread *);
+static void wakeup_push (struct cpu *, struct thread *);
+static void wakeup_drain (struct cpu *);
+static bool is_idle (const struct thread *);
+static void run_queue_insert (struct cpu *, struct thread *);
+static void run_queue_erase (struct cpu *, struct thread *);
+static void balance (struct cpu *, int min_imbalance);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_update_priority (struct thread *);
+static void mlfqs_mark (struct thread *);
+static void mlfqs_forget (struct thread *);
+static bool held_lock_less (const struct heap_elem *, const struct heap_elem *,
+		void *aux);
 
 /* Returns true if T appears to point to a valid thread. */
 #define is_thread(t) ((t) != NULL && (t)->magic == THREAD_MAGIC)
@@ -107,8 +156,18 @@ thread_init (void) {
 
 	/* Init the globla thread context */
 	lock_init (&tid_lock);
-	list_init (&ready_list);
+	for (int i = 0; i < CPU_MAX; i++) {
+		struct cpu *c = &cpus[i];
+
+		c->id = i;
+		spin_lock_init (&c->lock);
+		for (int pri = PRI_MIN; pri <= PRI_MAX; pri++)
+			list_init (&c->ready_queues[pri]);
+	}
 	list_init (&destruction_req);
+	list_init (&active_list);
+	list_init (&dirty_list);
+	load_avg = 0;
 
 	/* Set up a thread structure for the running thread. */
 	initial_thread = running_thread ();
@@ -129,36 +188,77 @@ thread_start (void) {
 	/* Start preemptive thread scheduling. */
 	intr_enable ();
 
-	/* Wait for the idle thread to initialize idle_thread. */
+	/* Wait for the idle thread to record itself. */
 	sema_down (&idle_started);
 }
 
+/* Turns PAGE into the idle thread of application processor C,
+   which C runs in from the moment it starts.  Called by the
+   bootstrap processor before it starts C. */
+void
+thread_init_ap (struct cpu *c, void *page) {
+	struct thread *t = page;
+	char name[16];
+
+	snprintf (name, sizeof name, "idle%d", c->id);
+	init_thread (t, name, PRI_MIN);
+	t->status = THREAD_RUNNING;
+	t->tid = allocate_tid ();
+	t->cpu = c;
+	c->idle_thread = t;
+}
+
 /* Called by the timer interrupt handler at each timer tick.
-   Thus, this function runs in an external interrupt context. */
+   Thus, this function usually runs in an external interrupt
+   context.  The idle thread also calls it, through
+   timer_idle_exit(), to account for ticks that passed while the
+   timer was in one-shot mode; preemption is meaningless for the
+   idle thread, so it is never asked to yield. */
 void
 thread_tick (void) {
+	struct cpu *c = cpu_current ();
 	struct thread *t = thread_current ();
 
 	/* Update statistics. */
-	if (t == idle_thread)
-		idle_ticks++;
+	if (t == c->idle_thread)
+		c->idle_ticks++;
 #ifdef USERPROG
 	else if (t->pml4 != NULL)
-		user_ticks++;
+		c->user_ticks++;
 #endif
 	else
-		kernel_ticks++;
+		c->kernel_ticks++;
+	if (t != c->idle_thread)
+		t->run_ticks++;
+
+	if (thread_mlfqs)
+		mlfqs_tick (t);
+
+	if (timer_ticks () % BALANCE_TICKS == 0)
+		balance (c, BALANCE_IMBALANCE);
 
 	/* Enforce preemption. */
-	if (++thread_ticks >= TIME_SLICE)
+	if (t != c->idle_thread && ++c->thread_ticks >= TIME_SLICE)
 		intr_yield_on_return ();
 }
 
-/* Prints thread statistics. */
+/* Prints thread statistics, summed over all CPUs. */
 void
 thread_print_stats (void) {
+	long long idle_ticks = 0, kernel_ticks = 0, user_ticks = 0;
+	int i;
+
+	for (i = 0; i < cpu_cnt; i++) {
+		idle_ticks += cpus[i].idle_ticks;
+		kernel_ticks += cpus[i].kernel_ticks;
+		user_ticks += cpus[i].user_ticks;
+	}
 	printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
 			idle_ticks, kernel_ticks, user_ticks);
+	for (i = 0; i < cpu_cnt; i++)
+		if (cpus[i].online)
+			printf ("CPU %d: %lld steals, %lld threads migrated in\n",
+					i, cpus[i].steals, cpus[i].migrations);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -173,9 +273,11 @@ thread_print_stats (void) {
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread has a higher priority than the running
+   thread, the running thread yields to it immediately.  Under
+   the MLFQS, PRIORITY is ignored: the new thread inherits its
+   creator's nice and recent_cpu and its priority is computed
+   from them. */
 tid_t
 thread_create (const char *name, int priority,
 		thread_func *function, void *aux) {
@@ -192,6 +294,16 @@ thread_create (const char *name, int priority,
 	/* Initialize thread. */
 	init_thread (t, name, priority);
 	tid = t->tid = allocate_tid ();
+	if (thread_mlfqs) {
+		struct thread *curr = thread_current ();
+		enum intr_level old_level = intr_disable ();
+
+		t->nice = curr->nice;
+		t->recent_cpu = curr->recent_cpu;
+		mlfqs_update_priority (t);
+		mlfqs_mark (t);
+		intr_set_level (old_level);
+	}
 
 	/* Call the kernel_thread if it scheduled.
 	 * Note) rdi is 1st argument, and rsi is 2nd argument. */
@@ -206,6 +318,8 @@ thread_create (const char *name, int priority,
 
 	/* Add to run queue. */
 	thread_unblock (t);
+	if (t->priority > thread_get_priority ())
+		thread_yield ();
 
 	return tid;
 }
@@ -231,16 +345,32 @@ thread_block (void) {
    This function does not preempt the running thread.  This can
    be important: if the caller had disabled interrupts itself,
    it may expect that it can atomically unblock a thread and
-   update other data. */
+   update other data.
+
+   Called from an interrupt handler, this only hands T over to
+   the next schedule(), asking for it to happen on return from
+   the interrupt if T outranks the running thread.  T stays in
+   the blocked state until then. */
 void
 thread_unblock (struct thread *t) {
 	enum intr_level old_level;
 
 	ASSERT (is_thread (t));
 
+	sched_trace_ready (t);
+	if (intr_context ()) {
+		struct thread *curr = thread_current ();
+
+		ASSERT (t->status == THREAD_BLOCKED);
+		wakeup_push (cpu_current (), t);
+		if (!is_idle (curr) && t->priority > curr->priority)
+			intr_yield_on_return ();
+		return;
+	}
+
 	old_level = intr_disable ();
 	ASSERT (t->status == THREAD_BLOCKED);
-	list_push_back (&ready_list, &t->elem);
+	ready_queue_push (cpu_current (), t);
 	t->status = THREAD_READY;
 	intr_set_level (old_level);
 }
@@ -288,6 +418,7 @@ thread_exit (void) {
 	/* Just set our status to dying and schedule another process.
 	   We will be destroyed during the call to schedule_tail(). */
 	intr_disable ();
+	mlfqs_forget (thread_current ());
 	do_schedule (THREAD_DYING);
 	NOT_REACHED ();
 }
@@ -302,16 +433,107 @@ thread_yield (void) {
 	ASSERT (!intr_context ());
 
 	old_level = intr_disable ();
-	if (curr != idle_thread)
-		list_push_back (&ready_list, &curr->elem);
+	if (!is_idle (curr)) {
+		sched_trace_ready (curr);
+		ready_queue_push (cpu_current (), curr);
+	}
 	do_schedule (THREAD_READY);
 	intr_set_level (old_level);
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Yields the CPU if a ready thread has a higher priority than
+   the running thread.  Within an interrupt handler, the yield
+   happens on return from the interrupt.  The idle thread never
+   needs to yield, because it blocks as soon as it runs. */
+void
+thread_preempt (void) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+	bool preempt;
+
+	if (is_idle (curr))
+		return;
+
+	old_level = intr_disable ();
+	preempt = ready_queue_max_priority (cpu_current ()) > curr->priority;
+	intr_set_level (old_level);
+
+	if (!preempt)
+		return;
+	if (intr_context ())
+		intr_yield_on_return ();
+	else
+		thread_yield ();
+}
+
+/* Sets the current thread's priority to NEW_PRIORITY.  Yields
+   if some ready thread now has a higher priority.  Ignored under
+   the MLFQS, which computes priorities itself. */
 void
 thread_set_priority (int new_priority) {
-	thread_current ()->priority = new_priority;
+	ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+	struct thread *curr = thread_current ();
+
+	if (thread_mlfqs)
+		return;
+
+	spin_lock (&donation_lock);
+	curr->base_priority = new_priority;
+	thread_change_priority (curr, thread_donated_priority (curr));
+	spin_unlock (&donation_lock);
+
+	thread_preempt ();
+}
+
+/* Returns the priority T should run at: the higher of its base
+   priority and the highest priority donated to it through the
+   locks it holds. */
+int
+thread_donated_priority (const struct thread *t) {
+	int priority = t->base_priority;
+
+	if (!heap_empty (&t->held_locks)) {
+		struct lock *lock = heap_entry (heap_top (&t->held_locks),
+				struct lock, elem);
+		if (lock->max_priority > priority)
+			priority = lock->max_priority;
+	}
+	return priority;
+}
+
+/* Sets T's effective priority to PRIORITY, moving T to the
+   matching run queue bucket if it is ready, or re-sorting it
+   among the waiters of the semaphore it is blocked on.
+   Interrupts must be off.  If T is waiting in any other
+   priority-ordered queue, the caller must take it out first and
+   reinsert it after. */
+void
+thread_change_priority (struct thread *t, int priority) {
+	struct semaphore *sema;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+	if (priority == t->priority)
+		return;
+	if (t->status == THREAD_READY) {
+		struct cpu *c = t->cpu;
+
+		ready_queue_remove (t);
+		t->priority = priority;
+		ready_queue_push (c, t);
+	} else if ((sema = t->waiting_sema) != NULL) {
+		spin_lock (&sema->lock);
+		if (t->waiting_sema == sema) {
+			heap_remove (&sema->waiters, &t->sema_elem);
+			t->priority = priority;
+			heap_push (&sema->waiters, &t->sema_elem);
+		} else
+			t->priority = priority;
+		spin_unlock (&sema->lock);
+	} else
+		t->priority = priority;
 }
 
 /* Returns the current thread's priority. */
@@ -320,54 +542,194 @@ thread_get_priority (void) {
 	return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE, recomputes its
+   priority and yields if it no longer has the highest. */
 void
-thread_set_nice (int nice UNUSED) {
-	/* TODO: Your implementation goes here */
+thread_set_nice (int nice) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+
+	ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+	old_level = intr_disable ();
+	curr->nice = nice;
+	if (thread_mlfqs) {
+		mlfqs_update_priority (curr);
+		mlfqs_mark (curr);
+	}
+	intr_set_level (old_level);
+
+	thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	enum intr_level old_level = intr_disable ();
+	int load_avg_100 = fp_round (load_avg * 100);
+	intr_set_level (old_level);
+
+	return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	enum intr_level old_level = intr_disable ();
+	int recent_cpu_100 = fp_round (thread_current ()->recent_cpu * 100);
+	intr_set_level (old_level);
+
+	return recent_cpu_100;
+}
+
+/* Per-tick MLFQS bookkeeping, with T as the running thread.
+   Charges the tick to T, recomputes the load average and decays
+   every active thread's recent_cpu once a second, and updates
+   the priorities of dirty threads every TIME_SLICE ticks. */
+static void
+mlfqs_tick (struct thread *t) {
+	int64_t now = timer_ticks ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!is_idle (t)) {
+		t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+		mlfqs_mark (t);
+	}
+
+	if (now % TIMER_FREQ == 0) {
+		int ready_threads;
+		fixed_t coef;
+		struct list_elem *e, *next;
+
+		/* Count threads woken since the last schedule() too. */
+		wakeup_drain (cpu_current ());
+		ready_threads = cpu_current ()->ready_cnt + (is_idle (t) ? 0 : 1);
+		load_avg = (59 * load_avg + fp_from_int (ready_threads)) / 60;
+		coef = fp_div (2 * load_avg, fp_add_int (2 * load_avg, 1));
+
+		for (e = list_begin (&active_list); e != list_end (&active_list);
+				e = next) {
+			struct thread *a = list_entry (e, struct thread, active_elem);
+
+			next = list_next (e);
+			a->recent_cpu = fp_add_int (fp_mul (coef, a->recent_cpu), a->nice);
+			mlfqs_mark (a);
+		}
+	}
+
+	if (now % TIME_SLICE == 0) {
+		while (!list_empty (&dirty_list)) {
+			struct thread *d = list_entry (list_pop_front (&dirty_list),
+					struct thread, dirty_elem);
+
+			d->mlfqs_dirty = false;
+			mlfqs_update_priority (d);
+		}
+	}
+}
+
+/* Recomputes T's priority from its recent_cpu and nice, moving
+   it to the matching run queue bucket if it is ready. */
+static void
+mlfqs_update_priority (struct thread *t) {
+	int priority = PRI_MAX - fp_to_int (t->recent_cpu / 4) - t->nice * 2;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (priority < PRI_MIN)
+		priority = PRI_MIN;
+	else if (priority > PRI_MAX)
+		priority = PRI_MAX;
+
+	thread_change_priority (t, priority);
+}
+
+/* Records that T's recent_cpu or nice changed: puts T on
+   dirty_list, and on active_list unless both are now zero, in
+   which case the per-second decay cannot change it any more. */
+static void
+mlfqs_mark (struct thread *t) {
+	bool active = t->recent_cpu != 0 || t->nice != 0;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (is_idle (t))
+		return;
+
+	if (!t->mlfqs_dirty) {
+		list_push_back (&dirty_list, &t->dirty_elem);
+		t->mlfqs_dirty = true;
+	}
+	if (active && !t->mlfqs_active) {
+		list_push_back (&active_list, &t->active_elem);
+		t->mlfqs_active = true;
+	} else if (!active && t->mlfqs_active) {
+		list_remove (&t->active_elem);
+		t->mlfqs_active = false;
+	}
+}
+
+/* Takes dying thread T off the MLFQS lists. */
+static void
+mlfqs_forget (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (t->mlfqs_dirty) {
+		list_remove (&t->dirty_elem);
+		t->mlfqs_dirty = false;
+	}
+	if (t->mlfqs_active) {
+		list_remove (&t->active_elem);
+		t->mlfqs_active = false;
+	}
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
    thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
+   point it records itself as its CPU's idle thread, "up"s the semaphore passed
    to it to enable thread_start() to continue, and immediately
    blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   run queue.  It is returned by next_thread_to_run() as a
+   special case when the run queue is empty. */
 static void
 idle (void *idle_started_ UNUSED) {
 	struct semaphore *idle_started = idle_started_;
 
-	idle_thread = thread_current ();
+	struct cpu *c = cpu_current ();
+
+	c->idle_thread = thread_current ();
 	sema_up (idle_started);
 
 	for (;;) {
 		/* Let someone else run. */
 		intr_disable ();
+		timer_idle_exit ();
 		thread_block ();
 
+		/* Nobody else is ready, so zero free pages ahead of
+		   PAL_ZERO requests, one at a time.  Threads woken by
+		   interrupts meanwhile do not preempt us, so check for
+		   them after each page. */
+		intr_enable ();
+		while (c->ready_cnt == 0 && c->wakeup_stack == NULL
+				&& palloc_prezero ())
+			continue;
+		intr_disable ();
+		if (c->ready_cnt > 0 || c->wakeup_stack != NULL)
+			continue;
+
+		/* Nobody else is ready, so stop the periodic timer tick
+		   until the next sleeping thread is due. */
+		timer_idle_enter ();
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -407,21 +769,218 @@ init_thread (struct thread *t, const char *name, int priority) {
 	t->status = THREAD_BLOCKED;
 	strlcpy (t->name, name, sizeof t->name);
 	t->tf.rsp = (uint64_t) t + PGSIZE - sizeof (void *);
-	t->priority = priority;
+	t->priority = t->base_priority = thread_mlfqs ? PRI_MAX : priority;
+	heap_init (&t->held_locks, held_lock_less, NULL);
+	t->nice = NICE_DEFAULT;
+	t->recent_cpu = 0;
 	t->magic = THREAD_MAGIC;
 }
 
+/* Orders locks in a thread's held_locks by the priority they
+   donate. */
+static bool
+held_lock_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct lock *a = heap_entry (a_, struct lock, elem);
+	const struct lock *b = heap_entry (b_, struct lock, elem);
+
+	return a->max_priority < b->max_priority;
+}
+
+/* Appends T to the run queue of its priority level on CPU C.
+   Interrupts must be off. */
+static void
+ready_queue_push (struct cpu *c, struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+	spin_lock (&c->lock);
+	run_queue_insert (c, t);
+	spin_unlock (&c->lock);
+}
+
+/* Removes ready thread T from the run queue it is on.
+   Interrupts must be off. */
+static void
+ready_queue_remove (struct thread *t) {
+	struct cpu *c = t->cpu;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (t->status == THREAD_READY);
+
+	spin_lock (&c->lock);
+	run_queue_erase (c, t);
+	spin_unlock (&c->lock);
+}
+
+/* Appends T to CPU C's run queue.  C's lock must be held. */
+static void
+run_queue_insert (struct cpu *c, struct thread *t) {
+	list_push_back (&c->ready_queues[t->priority], &t->elem);
+	c->ready_bitmap |= 1ULL << t->priority;
+	c->ready_cnt++;
+	t->cpu = c;
+}
+
+/* Removes T from CPU C's run queue.  C's lock must be held. */
+static void
+run_queue_erase (struct cpu *c, struct thread *t) {
+	list_remove (&t->elem);
+	if (list_empty (&c->ready_queues[t->priority]))
+		c->ready_bitmap &= ~(1ULL << t->priority);
+	c->ready_cnt--;
+}
+
+/* Removes and returns the oldest thread of the highest non-empty
+   priority level on CPU C, or NULL if C's run queue is empty.
+   Interrupts must be off. */
+static struct thread *
+ready_queue_pop (struct cpu *c) {
+	struct list *queue;
+	struct thread *t = NULL;
+	int pri;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	spin_lock (&c->lock);
+	pri = ready_queue_max_priority (c);
+	if (pri >= PRI_MIN) {
+		queue = &c->ready_queues[pri];
+		t = list_entry (list_pop_front (queue), struct thread, elem);
+		if (list_empty (queue))
+			c->ready_bitmap &= ~(1ULL << pri);
+		c->ready_cnt--;
+	}
+	spin_unlock (&c->lock);
+	return t;
+}
+
+/* Returns the highest priority among threads ready on CPU C, or
+   PRI_MIN - 1 if none is. */
+static int
+ready_queue_max_priority (struct cpu *c) {
+	uint64_t bitmap = c->ready_bitmap;
+
+	if (bitmap == 0)
+		return PRI_MIN - 1;
+	return 63 - __builtin_clzll (bitmap);
+}
+
+/* Pushes T, which an interrupt handler unblocked, onto CPU C's
+   wakeup stack. */
+static void
+wakeup_push (struct cpu *c, struct thread *t) {
+	struct thread *head = __atomic_load_n (&c->wakeup_stack, __ATOMIC_RELAXED);
+
+	do
+		t->wakeup_next = head;
+	while (!__atomic_compare_exchange_n (&c->wakeup_stack, &head, t, true,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Moves every thread on CPU C's wakeup stack to its run queue,
+   in the order they were unblocked.  Interrupts must be off. */
+static void
+wakeup_drain (struct cpu *c) {
+	struct thread *t, *next, *fifo = NULL;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	/* The stack is newest first, so reverse it. */
+	t = __atomic_exchange_n (&c->wakeup_stack, NULL, __ATOMIC_ACQUIRE);
+	for (; t != NULL; t = next) {
+		next = t->wakeup_next;
+		t->wakeup_next = fifo;
+		fifo = t;
+	}
+
+	for (t = fifo; t != NULL; t = next) {
+		next = t->wakeup_next;
+		ASSERT (t->status == THREAD_BLOCKED);
+		ready_queue_push (c, t);
+		t->status = THREAD_READY;
+	}
+}
+
+/* Returns true if T is the idle thread of the CPU we run on. */
+static bool
+is_idle (const struct thread *t) {
+	return t == cpu_current ()->idle_thread;
+}
+
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   the CPU's idle thread. */
 static struct thread *
 next_thread_to_run (void) {
-	if (list_empty (&ready_list))
-		return idle_thread;
-	else
-		return list_entry (list_pop_front (&ready_list), struct thread, elem);
+	struct cpu *c = cpu_current ();
+	struct thread *next;
+
+	wakeup_drain (c);
+	next = ready_queue_pop (c);
+	if (next == NULL) {
+		/* Rather than go idle, take work from a busier CPU. */
+		balance (c, 1);
+		next = ready_queue_pop (c);
+	}
+
+	return next != NULL ? next : c->idle_thread;
+}
+
+/* Moves ready threads from the busiest other online CPU to
+   THIEF, if that CPU has at least MIN_IMBALANCE more ready
+   threads than THIEF.  Interrupts must be off. */
+static void
+balance (struct cpu *thief, int min_imbalance) {
+	struct cpu *victim = NULL, *first, *second;
+	int i, pri, moved = 0, quota;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	/* Nothing to balance until a second CPU is online, which is
+	   the case at every boot for now; see threads/cpu.h. */
+	if (cpu_online_cnt () < 2)
+		return;
+
+	for (i = 0; i < cpu_cnt; i++) {
+		struct cpu *c = &cpus[i];
+
+		if (c != thief && c->online
+				&& (victim == NULL || c->ready_cnt > victim->ready_cnt))
+			victim = c;
+	}
+	if (victim == NULL
+			|| victim->ready_cnt - thief->ready_cnt < min_imbalance)
+		return;
+
+	/* Take the two locks in a fixed order. */
+	first = thief->id < victim->id ? thief : victim;
+	second = first == thief ? victim : thief;
+	spin_lock (&first->lock);
+	spin_lock (&second->lock);
+
+	quota = (victim->ready_cnt - thief->ready_cnt + 1) / 2;
+	for (pri = PRI_MIN; pri <= PRI_MAX && moved < quota; pri++) {
+		struct list *queue = &victim->ready_queues[pri];
+
+		while (!list_empty (queue) && moved < quota) {
+			struct thread *t = list_entry (list_back (queue),
+					struct thread, elem);
+
+			run_queue_erase (victim, t);
+			run_queue_insert (thief, t);
+			moved++;
+		}
+	}
+	if (moved > 0) {
+		thief->steals++;
+		thief->migrations += moved;
+	}
+
+	spin_unlock (&second->lock);
+	spin_unlock (&first->lock);
 }
 
 /* Use iretq to launch the thread */
@@ -546,11 +1105,13 @@ schedule (void) {
 	ASSERT (intr_get_level () == INTR_OFF);
 	ASSERT (curr->status != THREAD_RUNNING);
 	ASSERT (is_thread (next));
+	sched_trace_switch (curr, next);
+
 	/* Mark us as running. */
 	next->status = THREAD_RUNNING;
 
 	/* Start new time slice. */
-	thread_ticks = 0;
+	cpu_current ()->thread_ticks = 0;
 
 #ifdef USERPROG
 	/* Activate the new address space. */
@@ -0,0 +1,286 @@
+#include "threads/tlb.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/cpu.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* CPUID.01H:ECX bit that reports PCID support. */
+#define CPUID_PCID (1u << 17)
+
+/* CR4 bit that enables PCIDs. */
+#define CR4_PCIDE (1ul << 17)
+
+/* CR3 bit that keeps the TLB entries of the PCID being loaded. */
+#define CR3_NOFLUSH (1ul << 63)
+
+static bool pcid_supported;     /* CPU has PCIDs? */
+static bool pcid_enabled;       /* Using them? */
+
+/* Statistics. */
+static long long pcid_hits;     /* Switches that kept the TLB. */
+static long long pcid_misses;   /* Switches that flushed one PCID. */
+static long long full_flushes;  /* Switches or batches that flushed all. */
+static long long page_flushes;  /* Pages invalidated one by one. */
+static long long batch_flushes; /* tlb_batch_flush() calls that did work. */
+
+static bool is_active (uint64_t *pml4);
+static void mark_stale (uint64_t *pml4, bool release);
+static void defer_pages (uint64_t *pml4, const uint64_t *va, size_t cnt);
+
+/* Turns on PCIDs if the CPU has them.  Must be called with
+   PCID 0 loaded in CR3, which is always the case at boot. */
+void
+tlb_init (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid (1, 0, &eax, &ebx, &ecx, &edx);
+	pcid_supported = (ecx & CPUID_PCID) != 0;
+	if (pcid_supported) {
+		ASSERT ((rcr3 () & PGMASK) == 0);
+		lcr4 (rcr4 () | CR4_PCIDE);
+		pcid_enabled = true;
+	}
+	printf ("tlb: PCID %s\n", pcid_enabled ? "enabled" : "not supported");
+}
+
+/* Starts or stops tagging address spaces with PCIDs, which is
+   only useful for measuring what they buy.  Returns false if the
+   CPU has no PCIDs, in which case nothing changes. */
+bool
+tlb_set_pcid (bool enable) {
+	enum intr_level old_level;
+	int i, j;
+
+	if (!pcid_supported)
+		return false;
+
+	old_level = intr_disable ();
+	if (enable && !pcid_enabled) {
+		/* While disabled, nothing tracked what the entries of
+		   each PCID still map. */
+		for (i = 0; i < cpu_cnt; i++) {
+			for (j = 0; j < TLB_ASIDS; j++) {
+				cpus[i].asids[j].pml4 = NULL;
+				cpus[i].asids[j].pending_cnt = 0;
+			}
+			cpus[i].base_stale = true;
+		}
+	}
+	pcid_enabled = enable;
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Loads PML4 into CR3.  Keeps the TLB entries PML4 left on this
+   CPU the last time it ran, if it still has its PCID. */
+void
+tlb_activate (uint64_t *pml4) {
+	struct cpu *c;
+	struct tlb_asid *asid, *victim;
+	enum intr_level old_level;
+	uint64_t cr3 = vtop (pml4);
+	size_t pending_cnt = 0;
+	int i;
+
+	if (!pcid_enabled) {
+		lcr3 (cr3);
+		full_flushes++;
+		return;
+	}
+
+	old_level = intr_disable ();
+	c = cpu_current ();
+	c->asid_clock++;
+	if (pml4 == base_pml4) {
+		/* Only kernel mappings, which never change. */
+		if (c->base_stale)
+			c->base_stale = false;
+		else
+			cr3 |= CR3_NOFLUSH;
+	} else {
+		asid = victim = NULL;
+		for (i = 0; i < TLB_ASIDS; i++) {
+			struct tlb_asid *a = &c->asids[i];
+			if (a->pml4 == pml4) {
+				asid = a;
+				break;
+			}
+			if (victim == NULL || a->pml4 == NULL
+					|| (victim->pml4 != NULL && a->last_used < victim->last_used))
+				victim = a;
+		}
+		if (asid == NULL) {
+			asid = victim;
+			asid->pml4 = pml4;
+			asid->stale = true;
+		}
+		asid->last_used = c->asid_clock;
+
+		cr3 |= asid - c->asids + 1;
+		if (asid->stale) {
+			asid->stale = false;
+			pcid_misses++;
+		} else {
+			cr3 |= CR3_NOFLUSH;
+			pending_cnt = asid->pending_cnt;
+			pcid_hits++;
+		}
+		asid->pending_cnt = 0;
+	}
+	lcr3 (cr3);
+
+	/* Pages whose mappings changed while PML4 was not loaded
+	   here.  invlpg only reaches the current PCID, so this must
+	   follow the load. */
+	if (pending_cnt > 0) {
+		for (size_t j = 0; j < pending_cnt; j++)
+			invlpg (asid->pending[j]);
+		page_flushes += pending_cnt;
+	}
+	intr_set_level (old_level);
+}
+
+/* Makes every CPU forget any translation for user page VA in
+   PML4 that it may have cached. */
+void
+tlb_invalidate_page (uint64_t *pml4, const void *va) {
+	uint64_t page = (uint64_t) va;
+
+	if (is_active (pml4)) {
+		invlpg (page);
+		page_flushes++;
+	} else
+		defer_pages (pml4, &page, 1);
+}
+
+/* Drops every PCID assigned to PML4, which is about to be freed.
+   Its page may become another address space's PML4, which must
+   not inherit these TLB entries. */
+void
+tlb_release (uint64_t *pml4) {
+	ASSERT (!is_active (pml4));
+	mark_stale (pml4, true);
+}
+
+/* Starts gathering invalidations for PML4 in B. */
+void
+tlb_batch_init (struct tlb_batch *b, uint64_t *pml4) {
+	b->pml4 = pml4;
+	b->cnt = 0;
+}
+
+/* Adds user page VA to the pages B invalidates. */
+void
+tlb_batch_add (struct tlb_batch *b, const void *va) {
+	if (b->cnt < TLB_BATCH_MAX)
+		b->va[b->cnt] = (uint64_t) va;
+	b->cnt++;
+}
+
+/* Invalidates the pages gathered in B, then empties B.  A batch
+   of more than TLB_BATCH_MAX pages flushes the address space's
+   whole TLB instead, which is cheaper than that many invlpgs. */
+void
+tlb_batch_flush (struct tlb_batch *b) {
+	size_t i;
+
+	if (b->cnt == 0)
+		return;
+
+	batch_flushes++;
+	if (!is_active (b->pml4))
+		defer_pages (b->pml4, b->va, b->cnt);
+	else if (b->cnt <= TLB_BATCH_MAX) {
+		for (i = 0; i < b->cnt; i++)
+			invlpg (b->va[i]);
+		page_flushes += b->cnt;
+	} else {
+		/* Reloading CR3 without CR3_NOFLUSH flushes the current
+		   PCID only. */
+		lcr3 (rcr3 ());
+		full_flushes++;
+	}
+	b->cnt = 0;
+}
+
+/* Prints TLB statistics. */
+void
+tlb_print_stats (void) {
+	printf ("TLB: %lld PCID hits, %lld misses, %lld full flushes, "
+			"%lld pages invalidated, %lld batches\n",
+			pcid_hits, pcid_misses, full_flushes, page_flushes, batch_flushes);
+}
+
+/* Returns true if PML4 is loaded in this CPU's CR3. */
+static bool
+is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);
+}
+
+/* Marks the PCIDs that PML4 has on any CPU as stale, so that
+   their TLB entries are flushed when PML4 runs again there.  If
+   RELEASE is true, frees them instead.
+
+   Only the bootstrap processor runs, so no other CPU can have
+   PML4 loaded; once the APs run, those will need an IPI. */
+static void
+mark_stale (uint64_t *pml4, bool release) {
+	enum intr_level old_level;
+	int i, j;
+
+	if (!pcid_enabled)
+		return;
+
+	old_level = intr_disable ();
+	for (i = 0; i < cpu_cnt; i++)
+		for (j = 0; j < TLB_ASIDS; j++) {
+			struct tlb_asid *a = &cpus[i].asids[j];
+			if (a->pml4 == pml4) {
+				if (release)
+					a->pml4 = NULL;
+				else
+					a->stale = true;
+				a->pending_cnt = 0;
+			}
+		}
+	intr_set_level (old_level);
+}
+
+/* Remembers that the CNT user pages in VA, which PML4 does not
+   have loaded on this CPU, must be invalidated in each of its
+   PCIDs when PML4 next runs there.  A PCID that cannot remember
+   that many is marked stale instead, as is every PCID if CNT is
+   more than VA holds, as for an oversized tlb_batch.
+
+   As in mark_stale(), no other CPU can have PML4 loaded. */
+static void
+defer_pages (uint64_t *pml4, const uint64_t *va, size_t cnt) {
+	enum intr_level old_level;
+	int i, j;
+
+	if (!pcid_enabled)
+		return;
+	if (cnt > TLB_BATCH_MAX) {
+		mark_stale (pml4, false);
+		return;
+	}
+
+	old_level = intr_disable ();
+	for (i = 0; i < cpu_cnt; i++)
+		for (j = 0; j < TLB_ASIDS; j++) {
+			struct tlb_asid *a = &cpus[i].asids[j];
+			if (a->pml4 != pml4 || a->stale)
+				continue;
+			if (a->pending_cnt + cnt > TLB_PENDING_MAX) {
+				a->stale = true;
+				a->pending_cnt = 0;
+			} else
+				for (size_t k = 0; k < cnt; k++)
+					a->pending[a->pending_cnt++] = va[k];
+		}
+	intr_set_level (old_level);
+}
@@ -1,7 +1,14 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
+#include <bitmap.h>
+#include <stdio.h>
+#include <string.h>
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,11 +24,60 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* The swap disk is divided into page-sized slots. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+#define SLOT_NONE SIZE_MAX
+
+/* Slots are handed out in order from a free run of at least
+ * SWAP_CLUSTER slots, so that pages evicted one after another
+ * land next to each other and can be read back with one
+ * command. */
+#define SWAP_CLUSTER 16
+
+/* A fault reads up to READAHEAD_MAX of the following slots along
+ * with its own, if they hold pages of the same process, and
+ * keeps them in the swap cache of SWAP_CACHE_SIZE pages. */
+#define READAHEAD_MAX 8
+#define SWAP_CACHE_SIZE 32
+
+/* A page read ahead of its fault. */
+struct swap_cache_entry {
+	size_t slot;                /* Slot it was read from, or SLOT_NONE. */
+	void *kva;                  /* Its contents, or NULL if never used. */
+};
+
+static struct lock swap_lock;       /* Protects everything below. */
+static struct bitmap *swap_slots;   /* Slots in use. */
+static struct thread **slot_owners; /* Thread that swapped each slot out. */
+static size_t next_slot;            /* Where the current cluster goes on. */
+static struct swap_cache_entry swap_cache[SWAP_CACHE_SIZE];
+static size_t swap_cache_hand;      /* Next cache entry to replace. */
+
+/* Statistics. */
+static long long pages_out;         /* Pages written to swap. */
+static long long write_cmds;        /* Disk commands to write them. */
+static long long swap_faults;       /* Faults that swapped a page in. */
+static long long pages_in;          /* Pages read from swap. */
+static long long read_cmds;         /* Disk commands to read them. */
+static long long readahead_hits;    /* Faults served by the swap cache. */
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	size_t slot_cnt;
+
+	lock_init (&swap_lock);
+	swap_disk = disk_get (1, 1);
+	if (swap_disk == NULL)
+		return;
+
+	slot_cnt = disk_size (swap_disk) / SECTORS_PER_SLOT;
+	swap_slots = bitmap_create (slot_cnt);
+	slot_owners = calloc (slot_cnt, sizeof *slot_owners);
+	if (swap_slots == NULL || slot_owners == NULL)
+		PANIC ("swap: out of memory for %zu slots", slot_cnt);
+	for (size_t i = 0; i < SWAP_CACHE_SIZE; i++)
+		swap_cache[i].slot = SLOT_NONE;
 }
 
 /* Initialize the file mapping */
@@ -31,22 +87,226 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = SLOT_NONE;
+	return true;
+}
+
+/* Allocates CNT contiguous swap slots, continuing the current
+ * cluster if it can, and returns the first.  Returns SLOT_NONE if
+ * swap has no CNT free slots in a row. */
+static size_t
+slot_alloc (size_t cnt) {
+	size_t slot;
+
+	ASSERT (lock_held_by_current_thread (&swap_lock));
+
+	slot = next_slot;
+	if (slot + cnt > bitmap_size (swap_slots)
+			|| !bitmap_none (swap_slots, slot, cnt)) {
+		slot = bitmap_scan (swap_slots, 0,
+				cnt > SWAP_CLUSTER ? cnt : SWAP_CLUSTER, false);
+		if (slot == BITMAP_ERROR)
+			slot = bitmap_scan (swap_slots, 0, cnt, false);
+		if (slot == BITMAP_ERROR)
+			return SLOT_NONE;
+	}
+	bitmap_set_multiple (swap_slots, slot, cnt, true);
+	next_slot = slot + cnt;
+	return slot;
+}
+
+/* Returns the swap cache entry that holds SLOT, or NULL. */
+static struct swap_cache_entry *
+swap_cache_find (size_t slot) {
+	for (size_t i = 0; i < SWAP_CACHE_SIZE; i++)
+		if (swap_cache[i].slot == slot)
+			return &swap_cache[i];
+	return NULL;
+}
+
+/* Frees SLOT and drops it from the swap cache. */
+static void
+slot_free (size_t slot) {
+	struct swap_cache_entry *e;
+
+	ASSERT (lock_held_by_current_thread (&swap_lock));
+	ASSERT (bitmap_test (swap_slots, slot));
+
+	e = swap_cache_find (slot);
+	if (e != NULL)
+		e->slot = SLOT_NONE;
+	bitmap_reset (swap_slots, slot);
+	slot_owners[slot] = NULL;
+}
+
+/* Returns a swap cache entry to read a page into, replacing the
+ * oldest one, or NULL if a page cannot be had for it. */
+static struct swap_cache_entry *
+swap_cache_victim (void) {
+	struct swap_cache_entry *e = &swap_cache[swap_cache_hand];
+
+	if (e->kva == NULL) {
+		e->kva = palloc_get_page (0);
+		if (e->kva == NULL)
+			return NULL;
+	}
+	swap_cache_hand = (swap_cache_hand + 1) % SWAP_CACHE_SIZE;
+	e->slot = SLOT_NONE;
+	return e;
+}
+
+/* Reads SLOT into KVA, and as many of the slots after it that
+ * hold pages of the same process, and are not cached yet, into
+ * the swap cache, all with one disk command. */
+static void
+swap_read (size_t slot, void *kva) {
+	static void *buffers[(1 + READAHEAD_MAX) * SECTORS_PER_SLOT];
+	struct swap_cache_entry *ahead[READAHEAD_MAX];
+	size_t cnt, i;
+
+	ASSERT (lock_held_by_current_thread (&swap_lock));
+
+	for (cnt = 0; cnt < READAHEAD_MAX; cnt++) {
+		size_t next = slot + 1 + cnt;
+
+		if (next >= bitmap_size (swap_slots)
+				|| !bitmap_test (swap_slots, next)
+				|| slot_owners[next] != slot_owners[slot]
+				|| swap_cache_find (next) != NULL)
+			break;
+		ahead[cnt] = swap_cache_victim ();
+		if (ahead[cnt] == NULL)
+			break;
+	}
+
+	for (i = 0; i < SECTORS_PER_SLOT; i++)
+		buffers[i] = kva + i * DISK_SECTOR_SIZE;
+	for (size_t j = 0; j < cnt; j++)
+		for (i = 0; i < SECTORS_PER_SLOT; i++)
+			buffers[(j + 1) * SECTORS_PER_SLOT + i] =
+				ahead[j]->kva + i * DISK_SECTOR_SIZE;
+	disk_read_multiple (swap_disk, slot * SECTORS_PER_SLOT, buffers,
+			(cnt + 1) * SECTORS_PER_SLOT);
+	for (size_t j = 0; j < cnt; j++)
+		ahead[j]->slot = slot + 1 + j;
+
+	pages_in += cnt + 1;
+	read_cmds++;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	struct swap_cache_entry *e;
+
+	if (anon_page->slot == SLOT_NONE)
+		return false;
+
+	lock_acquire (&swap_lock);
+	e = swap_cache_find (anon_page->slot);
+	if (e != NULL) {
+		memcpy (kva, e->kva, PGSIZE);
+		readahead_hits++;
+	} else
+		swap_read (anon_page->slot, kva);
+	swap_faults++;
+	slot_free (anon_page->slot);
+	lock_release (&swap_lock);
+
+	anon_page->slot = SLOT_NONE;
+	return true;
+}
+
+/* Copies PAGE, which is swapped out, to KVA, leaving it in its
+ * slot, for fork(). */
+bool
+anon_swap_copy (struct page *page, void *kva) {
+	struct anon_page *anon_page = &page->anon;
+	struct swap_cache_entry *e;
+
+	if (anon_page->slot == SLOT_NONE)
+		return false;
+
+	lock_acquire (&swap_lock);
+	e = swap_cache_find (anon_page->slot);
+	if (e != NULL)
+		memcpy (kva, e->kva, PGSIZE);
+	else
+		swap_read (anon_page->slot, kva);
+	lock_release (&swap_lock);
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	return anon_swap_out_batch (&page, 1);
+}
+
+/* Writes the CNT anonymous pages in PAGES, each of which is in a
+ * frame, to as many contiguous swap slots, with one disk command.
+ * Returns false, writing none of them, if swap has no room for
+ * them all. */
+bool
+anon_swap_out_batch (struct page *pages[], size_t cnt) {
+	static const void *buffers[ANON_SWAP_BATCH * SECTORS_PER_SLOT];
+	size_t slot, i, j;
+
+	ASSERT (cnt > 0 && cnt <= ANON_SWAP_BATCH);
+
+	if (swap_disk == NULL)
+		return false;
+
+	lock_acquire (&swap_lock);
+	slot = slot_alloc (cnt);
+	if (slot == SLOT_NONE) {
+		lock_release (&swap_lock);
+		return false;
+	}
+	for (i = 0; i < cnt; i++) {
+		ASSERT (page_get_type (pages[i]) == VM_ANON);
+		slot_owners[slot + i] = pages[i]->frame->owner;
+		for (j = 0; j < SECTORS_PER_SLOT; j++)
+			buffers[i * SECTORS_PER_SLOT + j] =
+				pages[i]->frame->kva + j * DISK_SECTOR_SIZE;
+	}
+	disk_write_multiple (swap_disk, slot * SECTORS_PER_SLOT, buffers,
+			cnt * SECTORS_PER_SLOT);
+	pages_out += cnt;
+	write_cmds++;
+	lock_release (&swap_lock);
+
+	for (i = 0; i < cnt; i++)
+		pages[i]->anon.slot = slot + i;
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->slot == SLOT_NONE)
+		return;
+	lock_acquire (&swap_lock);
+	slot_free (anon_page->slot);
+	lock_release (&swap_lock);
+	anon_page->slot = SLOT_NONE;
+}
+
+/* Prints swap statistics. */
+void
+vm_anon_print_stats (void) {
+	long long faults = swap_faults > 0 ? swap_faults : 1;
+
+	if (swap_disk == NULL)
+		return;
+	printf ("Swap: %lld pages out in %lld writes, "
+			"%lld pages in in %lld reads, "
+			"%lld of %lld faults read ahead, "
+			"%lld.%02lld reads per fault\n",
+			pages_out, write_cmds, pages_in, read_cmds,
+			readahead_hits, swap_faults, read_cmds / faults,
+			read_cmds * 100 / faults % 100);
 }
@@ -1,6 +1,10 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <string.h>
 #include "vm/vm.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
+#include "vm/vma.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -22,37 +26,106 @@ vm_file_init (void) {
 /* Initialize the file backed page */
 bool
 file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+	/* File-backed pages only exist in areas, and are initialized
+	 * by the process that owns them. */
+	struct vma *vma = vma_find (&thread_current ()->spt, page->va);
+	size_t ofs = (uint8_t *) page->va - (uint8_t *) vma->start;
+
+	ASSERT (vma != NULL && vma->file != NULL);
+
 	/* Set up the handler */
 	page->operations = &file_ops;
 
 	struct file_page *file_page = &page->file;
+	file_page->file = vma->file;
+	file_page->offset = vma->offset + ofs;
+	file_page->read_bytes = 0;
+	if (ofs < vma->read_bytes)
+		file_page->read_bytes = vma->read_bytes - ofs < PGSIZE
+			? vma->read_bytes - ofs : PGSIZE;
+	return true;
+}
+
+/* Writes PAGE, which has a frame, back to its file if its owner
+ * has changed it.  Only the part backed by the file is written,
+ * so the file never grows. */
+static bool
+file_backed_write_back (struct page *page) {
+	struct file_page *file_page = &page->file;
+	struct frame *frame = page->frame;
+
+	if (!pml4_is_dirty (frame->pml4, page->va))
+		return true;
+	if (file_write_at (file_page->file, frame->kva, file_page->read_bytes,
+				file_page->offset) != (off_t) file_page->read_bytes)
+		return false;
+	pml4_set_dirty (frame->pml4, page->va, false);
+	return true;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (file_read_at (file_page->file, kva, file_page->read_bytes,
+				file_page->offset) != (off_t) file_page->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	return true;
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file.  The
+ * file keeps the contents, so no swap slot is needed. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	return file_backed_write_back (page);
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page. PAGE will be freed by the caller.
+ * A page still in memory is written back first, which is how
+ * munmap() and exit update the file. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	if (page->frame != NULL)
+		file_backed_write_back (page);
 }
 
-/* Do the mmap */
+/* Do the mmap.  Only an area is created, whatever LENGTH is; its
+ * pages are read from FILE as they are touched. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *end = pg_round_up ((uint8_t *) addr + length);
+	off_t file_len;
+	size_t read_bytes = 0;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0
+			|| end <= (uint8_t *) addr || !is_user_vaddr (end - 1))
+		return NULL;
+
+	file_len = file_length (file);
+	if (file_len == 0)
+		return NULL;
+	if (offset < file_len)
+		read_bytes = (size_t) (file_len - offset) < length
+			? (size_t) (file_len - offset) : length;
+
+	if (vma_insert (spt, addr, end, VM_FILE, writable, file, offset,
+				read_bytes) == NULL)
+		return NULL;
+	return addr;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma = vma_find (spt, addr);
+
+	if (vma != NULL && vma->start == addr && VM_TYPE (vma->type) == VM_FILE)
+		vma_remove (spt, vma);
 }
@@ -1,8 +1,56 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/tlb.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/vma.h"
+#include "intrinsic.h"
+
+struct kmem_cache *page_kmem_cache;
+struct kmem_cache *frame_kmem_cache;
+
+/* Frame table: every frame holding a user page, in a circle that
+ * the CLOCK hand sweeps.  New frames go just behind the hand, so
+ * they are looked at last. */
+static struct list frame_table;
+static struct list_elem *clock_hand;
+static struct lock frame_lock;
+
+int vm_ws_window;
+
+/* WSClock writeback.  Dirty pages that have left their working
+ * set are queued for the writeback thread, which evicts them and
+ * puts their frames on FREE_FRAMES for the next fault to take,
+ * so that faulting threads seldom have to write a page out. */
+static struct list free_frames;     /* Evicted frames, ready for use. */
+static struct list writeback_queue; /* Frames queued for writeback. */
+static size_t writeback_pending;    /* Frames queued or being written. */
+static struct semaphore writeback_sema; /* Upped for each queued frame. */
+static struct condition writeback_done; /* Signaled on completion. */
+
+/* Statistics. */
+static long long evictions;         /* Frames evicted. */
+static long long eviction_scans;    /* Frames looked at to evict them. */
+static long long eviction_scans_max; /* Most for one eviction. */
+static uint64_t eviction_cycles;    /* Time spent evicting. */
+static uint64_t eviction_cycles_max; /* Longest eviction. */
+static long long writebacks;        /* Frames evicted by writeback. */
+static long long faults;            /* Page faults handled. */
+static uint64_t fault_cycles;       /* Time spent handling them. */
+static uint64_t lookup_cycles;      /* Part spent finding the page. */
+
+static void page_free (struct page *, struct tlb_batch *);
+static spt_for_each_func page_copy;
+static void fault_account (uint64_t start, uint64_t found);
+static vm_initializer page_copy_load;
+static thread_func writeback_thread NO_RETURN;
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,6 +63,19 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
+	page_kmem_cache = kmem_cache_create ("page", sizeof (struct page), 0, NULL);
+	frame_kmem_cache = kmem_cache_create ("frame", sizeof (struct frame), 0,
+			NULL);
+	vm_vma_init ();
+	list_init (&frame_table);
+	clock_hand = NULL;
+	lock_init (&frame_lock);
+	list_init (&free_frames);
+	list_init (&writeback_queue);
+	sema_init (&writeback_sema, 0);
+	cond_init (&writeback_done);
+	if (vm_ws_window > 0)
+		thread_create ("vm writeback", PRI_DEFAULT, writeback_thread, NULL);
 	/* TODO: Your code goes here. */
 }
 
@@ -50,74 +111,649 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
-
-		/* TODO: Insert the page into the spt. */
+		struct page *page = kmem_cache_alloc (page_kmem_cache);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux,
+				VM_TYPE (type) == VM_FILE
+				? file_backed_initializer : anon_initializer);
+		page->writable = writable;
+
+		if (!spt_insert_page (spt, page)) {
+			kmem_cache_free (page_kmem_cache, page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
 }
 
+/* Supplemental page table levels, from the root, and the shift
+ * that selects the index into each. */
+#define SPT_LEVELS 4
+static const unsigned spt_shifts[SPT_LEVELS] = {
+	PML4SHIFT, PDPESHIFT, PDXSHIFT, PTXSHIFT
+};
+
+/* The node referenced by SLOT and its number of entries in use. */
+#define SLOT_NODE(SLOT) ((uintptr_t *) ((SLOT) & ~(uintptr_t) PGMASK))
+#define SLOT_CNT(SLOT) ((SLOT) & PGMASK)
+
+/* Returns the index of VA in a node at LEVEL. */
+static inline unsigned
+spt_index (uint64_t va, int level) {
+	return (va >> spt_shifts[level]) & 0x1ff;
+}
+
+/* Stores in PATH[L] the slot that references VA's node at each
+ * level L, as far down as those nodes exist.  Returns the number
+ * of levels found. */
+static int
+spt_walk (struct supplemental_page_table *spt, uint64_t va,
+		uintptr_t *path[SPT_LEVELS]) {
+	uintptr_t *slot = &spt->root;
+	int level;
+
+	for (level = 0; level < SPT_LEVELS && *slot != 0; level++) {
+		path[level] = slot;
+		slot = &SLOT_NODE (*slot)[spt_index (va, level)];
+	}
+	return level;
+}
+
+/* Frees the empty nodes at the bottom of PATH, which has DEPTH
+ * levels. */
+static void
+spt_prune (uintptr_t *path[SPT_LEVELS], int depth) {
+	while (depth-- > 0 && SLOT_CNT (*path[depth]) == 0) {
+		palloc_free_page (SLOT_NODE (*path[depth]));
+		*path[depth] = 0;
+		if (depth > 0)
+			(*path[depth - 1])--;
+	}
+}
+
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
-
-	return page;
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	uintptr_t slot = spt->root;
+	int level;
+
+	for (level = 0; level < SPT_LEVELS; level++) {
+		if (slot == 0)
+			return NULL;
+		slot = SLOT_NODE (slot)[spt_index ((uint64_t) va, level)];
+	}
+	return (struct page *) slot;
 }
 
-/* Insert PAGE into spt with validation. */
+/* Insert PAGE into spt with validation.  Fails if PAGE's address
+ * is already in use or if memory for the tree runs out. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt,
+		struct page *page) {
+	uint64_t va = (uint64_t) page->va;
+	uintptr_t *path[SPT_LEVELS];
+	uintptr_t *leaf;
+	int depth;
+
+	ASSERT (pg_ofs (page->va) == 0);
+	ASSERT (is_user_vaddr (page->va));
+
+	/* Create the missing nodes. */
+	depth = spt_walk (spt, va, path);
+	for (; depth < SPT_LEVELS; depth++) {
+		uintptr_t *slot = depth == 0 ? &spt->root
+			: &SLOT_NODE (*path[depth - 1])[spt_index (va, depth - 1)];
+		uintptr_t *node = palloc_get_page (PAL_ZERO);
+		if (node == NULL) {
+			spt_prune (path, depth);
+			return false;
+		}
+		*slot = (uintptr_t) node;
+		if (depth > 0)
+			(*path[depth - 1])++;
+		path[depth] = slot;
+	}
 
-	return succ;
+	leaf = &SLOT_NODE (*path[SPT_LEVELS - 1])[spt_index (va, SPT_LEVELS - 1)];
+	if (*leaf != 0)
+		return false;
+	*leaf = (uintptr_t) page;
+	(*path[SPT_LEVELS - 1])++;
+	return true;
 }
 
+/* Removes PAGE from SPT and frees it, along with any nodes left
+ * empty. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
-	vm_dealloc_page (page);
+	uint64_t va = (uint64_t) page->va;
+	uintptr_t *path[SPT_LEVELS];
+	uintptr_t *leaf;
+
+	if (spt_walk (spt, va, path) == SPT_LEVELS) {
+		leaf = &SLOT_NODE (*path[SPT_LEVELS - 1])[spt_index (va, SPT_LEVELS - 1)];
+		if (*leaf == (uintptr_t) page) {
+			*leaf = 0;
+			(*path[SPT_LEVELS - 1])--;
+			spt_prune (path, SPT_LEVELS);
+		}
+	}
+	page_free (page, NULL);
+}
+
+/* Returns the first index of a node at LEVEL, whose first
+ * address is BASE, that covers an address at or above START. */
+static unsigned
+first_index (uint64_t base, uint64_t start, int level) {
+	uint64_t idx;
+
+	if (start <= base)
+		return 0;
+	idx = (start - base) >> spt_shifts[level];
+	return idx < 512 ? idx : 512;
+}
+
+/* Calls FUNC on the pages in [START, END) below the node in SLOT
+ * at LEVEL, whose first address is BASE, in address order. */
+static bool
+node_for_each (uintptr_t slot, int level, uint64_t base, uint64_t start,
+		uint64_t end, spt_for_each_func *func, void *aux) {
+	uintptr_t *node = SLOT_NODE (slot);
+	uint64_t size = 1ULL << spt_shifts[level];
+	unsigned i;
+
+	for (i = first_index (base, start, level);
+			i < 512 && base + i * size < end; i++) {
+		if (node[i] == 0)
+			continue;
+		if (level == SPT_LEVELS - 1) {
+			if (!func ((struct page *) node[i], aux))
+				return false;
+		} else if (!node_for_each (node[i], level + 1, base + i * size,
+					start, end, func, aux))
+			return false;
+	}
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Calls FUNC on each page in SPT in [START, END), in address
+ * order, skipping empty subtrees, until FUNC returns false.
+ * Returns false if FUNC did, true otherwise.  FUNC must not add
+ * or remove pages. */
+bool
+spt_for_each (struct supplemental_page_table *spt, void *start, void *end,
+		spt_for_each_func *func, void *aux) {
+	if (spt->root == 0)
+		return true;
+	return node_for_each (spt->root, 0, 0, (uint64_t) start, (uint64_t) end,
+			func, aux);
+}
+
+/* Removes and frees the pages below the node in *SLOT at LEVEL,
+ * whose first address is BASE, in [START, END), and the nodes
+ * that become empty.  Their TLB entries are left in BATCH. */
+static void
+node_remove_range (uintptr_t *slot, int level, uint64_t base,
+		uint64_t start, uint64_t end, struct tlb_batch *batch) {
+	uintptr_t *node = SLOT_NODE (*slot);
+	uint64_t size = 1ULL << spt_shifts[level];
+	unsigned i;
+
+	for (i = first_index (base, start, level);
+			i < 512 && base + i * size < end; i++) {
+		if (node[i] == 0)
+			continue;
+		if (level == SPT_LEVELS - 1) {
+			page_free ((struct page *) node[i], batch);
+			node[i] = 0;
+			(*slot)--;
+		} else {
+			node_remove_range (&node[i], level + 1, base + i * size,
+					start, end, batch);
+			if (node[i] == 0)
+				(*slot)--;
+		}
+	}
+	if (SLOT_CNT (*slot) == 0) {
+		palloc_free_page (node);
+		*slot = 0;
+	}
+}
+
+/* Removes and frees every page in SPT, which must be the running
+ * process's, in [START, END), flushing the TLB once for all of
+ * them.  Until then the process is in the kernel here, so it
+ * cannot use the stale entries to reach the freed frames. */
+void
+spt_remove_range (struct supplemental_page_table *spt, void *start,
+		void *end) {
+	struct tlb_batch batch;
+
+	ASSERT (spt == &thread_current ()->spt);
+
+	if (spt->root == 0)
+		return;
+	tlb_batch_init (&batch, thread_current ()->pml4);
+	node_remove_range (&spt->root, 0, 0, (uint64_t) start, (uint64_t) end,
+			&batch);
+	tlb_batch_flush (&batch);
+}
+
+/* Moves the CLOCK hand to the next frame, wrapping around, and
+ * returns the frame it was on.  The frame table must not be
+ * empty. */
 static struct frame *
-vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+clock_advance (void) {
+	struct frame *frame;
+
+	if (clock_hand == NULL || clock_hand == list_end (&frame_table))
+		clock_hand = list_begin (&frame_table);
+	frame = list_entry (clock_hand, struct frame, elem);
+	clock_hand = list_next (clock_hand);
+	return frame;
+}
+
+/* Removes FRAME from the frame table. */
+static void
+frame_table_remove (struct frame *frame) {
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	list_remove (&frame->elem);
+}
+
+/* Adds FRAME to the frame table, just behind the CLOCK hand. */
+static void
+frame_table_insert (struct frame *frame) {
+	if (clock_hand == NULL || clock_hand == list_end (&frame_table))
+		list_push_back (&frame_table, &frame->elem);
+	else
+		list_insert (clock_hand, &frame->elem);
+}
+
+/* Returns true if FRAME's page may be evicted now: the frame is
+ * not pinned or on its way out, and the page's type can swap it
+ * out. */
+static bool
+frame_evictable (struct frame *frame) {
+	return !frame->pinned && !frame->writeback && frame->page != NULL
+		&& frame->page->operations->swap_out != NULL;
+}
+
+/* Returns the frame to evict under the CLOCK policy.
+ *
+ * This is the CLOCK, or second-chance, algorithm, preferring
+ * clean pages.  The hand sweeps the frame table, clearing each
+ * page's accessed bit, and takes the first page that was neither
+ * accessed nor dirty.  Failing that, it takes the first dirty page
+ * that was not accessed, and failing that, it sweeps once more,
+ * now that every accessed bit is clear.  A page's only mapping
+ * is the one in its owner's page map: the kernel's alias of the
+ * frame lies in the 2 MiB direct map, which has no per-frame
+ * accessed bit.  FRAME_LOCK must be held. */
+static struct frame *
+clock_victim (void) {
+	struct frame *victim = NULL, *dirty = NULL;
+	size_t frame_cnt = list_size (&frame_table);
+	size_t scans;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	for (scans = 0; victim == NULL && scans < 2 * frame_cnt; scans++) {
+		struct frame *frame = clock_advance ();
+		void *va;
+
+		if (!frame_evictable (frame))
+			continue;
+		va = frame->page->va;
+		if (pml4_is_accessed (frame->pml4, va)) {
+			pml4_set_accessed (frame->pml4, va, false);
+			continue;
+		}
+		if (!pml4_is_dirty (frame->pml4, va))
+			victim = frame;
+		else if (dirty == NULL)
+			dirty = frame;
+
+		/* After one full sweep, settle for a dirty page. */
+		if (victim == NULL && scans + 1 >= frame_cnt && dirty != NULL)
+			victim = dirty;
+	}
+
+	eviction_scans += scans;
+	if ((long long) scans > eviction_scans_max)
+		eviction_scans_max = scans;
+	return victim;
+}
+
+/* Returns the frame to evict under the WSClock policy.
+ *
+ * Each frame remembers when its page was last seen accessed, in
+ * its owner's virtual time, so that a process that runs a lot
+ * ages its own pages without aging everyone else's.  The hand
+ * sweeps the frame table once, and a second time if that found
+ * nothing, now that the first sweep has cleared every accessed
+ * bit.
+ * Accessed pages get their time updated and stay.  Pages used within the last VM_WS_WINDOW
+ * ticks of their owner's run time are in its working set and
+ * stay too.  Of the others, the first clean one is the victim,
+ * and dirty ones are queued for the writeback thread instead of
+ * being written by the faulting thread.
+ *
+ * If the sweeps find no victim, returns a null pointer when
+ * writebacks are pending, so that the caller can wait for one,
+ * and otherwise the page unused for longest in its owner's time,
+ * even if it is in the working set.  FRAME_LOCK must be held. */
+static struct frame *
+wsclock_victim (void) {
+	struct frame *victim = NULL, *oldest = NULL;
+	int64_t oldest_age = -1;
+	size_t frame_cnt = list_size (&frame_table);
+	size_t scans;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	for (scans = 0; victim == NULL && scans < 2 * frame_cnt; scans++) {
+		struct frame *frame;
+		int64_t now, age;
+		void *va;
+
+		/* Sweep again only if the first sweep found nothing. */
+		if (scans == frame_cnt && (oldest != NULL || writeback_pending > 0))
+			break;
+
+		frame = clock_advance ();
+		if (!frame_evictable (frame))
+			continue;
+		va = frame->page->va;
+		now = frame->owner->run_ticks;
+		if (pml4_is_accessed (frame->pml4, va)) {
+			pml4_set_accessed (frame->pml4, va, false);
+			frame->last_use = now;
+			continue;
+		}
+
+		age = now - frame->last_use;
+		if (age > oldest_age) {
+			oldest = frame;
+			oldest_age = age;
+		}
+		if (age <= vm_ws_window)
+			continue;
+		if (!pml4_is_dirty (frame->pml4, va))
+			victim = frame;
+		else {
+			frame->writeback = true;
+			writeback_pending++;
+			list_push_back (&writeback_queue, &frame->wb_elem);
+			sema_up (&writeback_sema);
+		}
+	}
 
+	eviction_scans += scans;
+	if ((long long) scans > eviction_scans_max)
+		eviction_scans_max = scans;
+	if (victim == NULL && writeback_pending == 0)
+		victim = oldest;
 	return victim;
 }
 
+/* Get the struct frame, that will be evicted, under the policy
+ * chosen at boot.  FRAME_LOCK must be held. */
+static struct frame *
+vm_get_victim (void) {
+	return vm_ws_window > 0 ? wsclock_victim () : clock_victim ();
+}
+
 /* Evict one page and return the corresponding frame.
  * Return NULL on error.*/
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	uint64_t start = rdtsc (), cycles;
+	struct frame *victim;
+	struct page *page;
+	bool ok;
+
+	lock_acquire (&frame_lock);
+	for (;;) {
+		/* Take a frame the writeback thread has freed, if any. */
+		if (!list_empty (&free_frames)) {
+			victim = list_entry (list_pop_front (&free_frames),
+					struct frame, elem);
+			frame_table_insert (victim);
+			lock_release (&frame_lock);
+			return victim;
+		}
+
+		victim = vm_get_victim ();
+		if (victim != NULL)
+			break;
+		if (writeback_pending == 0) {
+			lock_release (&frame_lock);
+			return NULL;
+		}
+		cond_wait (&writeback_done, &frame_lock);
+	}
 
-	return NULL;
+	/* Write the page out without the lock, as the writeback thread
+	 * does.  Unmap it first, so that its owner faults, and waits
+	 * in page_wait_writeback(), instead of changing it meanwhile. */
+	page = victim->page;
+	victim->pinned = true;
+	victim->writeback = true;
+	lock_release (&frame_lock);
+	pml4_clear_page (victim->pml4, page->va);
+	ok = swap_out (page);
+	lock_acquire (&frame_lock);
+
+	victim->writeback = false;
+	cond_broadcast (&writeback_done, &frame_lock);
+	if (!ok) {
+		pml4_set_page (victim->pml4, page->va, victim->kva, page->writable);
+		victim->pinned = false;
+		lock_release (&frame_lock);
+		return NULL;
+	}
+	page->frame = NULL;
+	victim->page = NULL;
+	victim->pml4 = NULL;
+	victim->owner = NULL;
+
+	evictions++;
+	cycles = rdtsc () - start;
+	eviction_cycles += cycles;
+	if (cycles > eviction_cycles_max)
+		eviction_cycles_max = cycles;
+	lock_release (&frame_lock);
+	return victim;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  That is, if the user pool memory is full, this
+ * function evicts the frame to get the available memory space.
+ * Returns a null pointer if no page can be evicted either.  The
+ * frame is pinned until the caller unpins it. */
 static struct frame *
 vm_get_frame (void) {
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	void *kva = palloc_get_page (PAL_USER);
+
+	if (kva == NULL)
+		frame = vm_evict_frame ();
+	else {
+		frame = kmem_cache_alloc (frame_kmem_cache);
+		if (frame == NULL)
+			PANIC ("out of memory for the frame table");
+		frame->kva = kva;
+		frame->page = NULL;
+		frame->pml4 = NULL;
+		frame->owner = NULL;
+		frame->pinned = true;
+		frame->writeback = false;
+
+		lock_acquire (&frame_lock);
+		frame_table_insert (frame);
+		lock_release (&frame_lock);
+	}
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	ASSERT (frame == NULL || frame->page == NULL);
 	return frame;
 }
 
+/* Removes FRAME, which holds no page, from the frame table and
+ * frees it. */
+static void
+frame_free (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	frame_table_remove (frame);
+	lock_release (&frame_lock);
+
+	palloc_free_page (frame->kva);
+	kmem_cache_free (frame_kmem_cache, frame);
+}
+
+/* Waits until PAGE's frame, if any, is not being written out
+ * by the writeback thread or an eviction, and returns it.  FRAME_LOCK must be
+ * held. */
+static struct frame *
+page_wait_writeback (struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	while (page->frame != NULL && page->frame->writeback)
+		cond_wait (&writeback_done, &frame_lock);
+	return page->frame;
+}
+
+/* Evicts the frames that WSClock queues, writing their pages out
+ * while faulting threads go on.  It takes up to ANON_SWAP_BATCH
+ * queued frames at a time, so that their anonymous pages go to
+ * contiguous swap slots with one disk command. */
+static void
+writeback_thread (void *aux UNUSED) {
+	for (;;) {
+		struct frame *batch[ANON_SWAP_BATCH];
+		struct page *anon[ANON_SWAP_BATCH];
+		bool ok[ANON_SWAP_BATCH];
+		size_t cnt = 0, anon_cnt = 0, i;
+
+		sema_down (&writeback_sema);
+		lock_acquire (&frame_lock);
+		do {
+			struct frame *frame = list_entry (list_pop_front (&writeback_queue),
+					struct frame, wb_elem);
+			struct page *page = frame->page;
+
+			/* Leave the page if it has been used again. */
+			if (frame->pinned || page == NULL
+					|| pml4_is_accessed (frame->pml4, page->va)) {
+				frame->writeback = false;
+				writeback_pending--;
+				cond_broadcast (&writeback_done, &frame_lock);
+				continue;
+			}
+			frame->pinned = true;
+			batch[cnt++] = frame;
+		} while (cnt < ANON_SWAP_BATCH && sema_try_down (&writeback_sema));
+		lock_release (&frame_lock);
+
+		/* Write the pages out without the lock.  Their owners fault,
+		 * and wait in page_wait_writeback(), if they touch them
+		 * meanwhile. */
+		for (i = 0; i < cnt; i++) {
+			struct page *page = batch[i]->page;
+
+			pml4_clear_page (batch[i]->pml4, page->va);
+			if (page_get_type (page) == VM_ANON)
+				anon[anon_cnt++] = page;
+			else
+				ok[i] = swap_out (page);
+		}
+		if (anon_cnt > 0) {
+			bool written = anon_swap_out_batch (anon, anon_cnt);
+
+			/* Without room for all of them in a row, try one by one. */
+			for (i = 0; i < cnt; i++)
+				if (page_get_type (batch[i]->page) == VM_ANON)
+					ok[i] = written || swap_out (batch[i]->page);
+		}
+
+		lock_acquire (&frame_lock);
+		for (i = 0; i < cnt; i++) {
+			struct frame *frame = batch[i];
+			struct page *page = frame->page;
+
+			if (ok[i]) {
+				page->frame = NULL;
+				frame->page = NULL;
+				frame->pml4 = NULL;
+				frame->owner = NULL;
+				frame_table_remove (frame);
+				list_push_back (&free_frames, &frame->elem);
+				writebacks++;
+			} else {
+				pml4_set_page (frame->pml4, page->va, frame->kva, page->writable);
+				frame->pinned = false;
+			}
+			frame->writeback = false;
+			writeback_pending--;
+		}
+		cond_broadcast (&writeback_done, &frame_lock);
+		lock_release (&frame_lock);
+	}
+}
+
+/* Destroys PAGE and frees it, along with its frame if it has
+ * one.  The frame's TLB entry is invalidated right away if BATCH
+ * is null, and otherwise left in BATCH. */
+static void
+page_free (struct page *page, struct tlb_batch *batch) {
+	struct frame *frame;
+	void *va = page->va;
+
+	/* Keep the frame from being evicted while PAGE's contents are
+	 * written back. */
+	lock_acquire (&frame_lock);
+	frame = page_wait_writeback (page);
+	if (frame != NULL)
+		frame->pinned = true;
+	lock_release (&frame_lock);
+
+	vm_dealloc_page (page);
+	if (frame == NULL)
+		return;
+
+	if (batch != NULL) {
+		ASSERT (frame->pml4 == batch->pml4);
+		pml4_clear_page_batch (batch, va);
+	} else
+		pml4_clear_page (frame->pml4, va);
+	frame_free (frame);
+}
+
+/* Prints frame table and eviction statistics. */
+void
+vm_print_stats (void) {
+	long long n = evictions > 0 ? evictions : 1;
+
+	printf ("Frames: %zu in use, %lld evictions, "
+			"%lld frames scanned per eviction (max %lld), "
+			"%llu cycles per eviction (max %llu)\n",
+			list_size (&frame_table), evictions, eviction_scans / n,
+			eviction_scans_max, (unsigned long long) eviction_cycles / n,
+			(unsigned long long) eviction_cycles_max);
+	if (faults > 0)
+		printf ("Faults: %lld handled in %llu cycles each, "
+				"%llu of them finding the page\n", faults,
+				(unsigned long long) (fault_cycles / faults),
+				(unsigned long long) (lookup_cycles / faults));
+	if (vm_ws_window > 0)
+		printf ("WSClock: window %d ticks, %lld pages written back "
+				"asynchronously\n", vm_ws_window, writebacks);
+	vm_anon_print_stats ();
+}
+
 /* Growing the stack. */
 static void
 vm_stack_growth (void *addr UNUSED) {
@@ -132,12 +768,50 @@ vm_handle_wp (struct page *page UNUSED) {
 bool
 vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
 		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint64_t start, found;
+	struct page *page;
+	bool ok;
 	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+	if (addr == NULL || !is_user_vaddr (addr) || !not_present)
+		return false;
+
+	/* Pages are created on first touch from the area that holds
+	 * them. */
+	start = rdtsc ();
+	page = spt_find_page (spt, addr);
+	found = rdtsc ();
+	if (page == NULL)
+		page = vma_fault (spt, addr);
+	if (page == NULL)
+		return false;
+
+	/* The page may be on its way out.  Once it has been written,
+	 * it is either gone or mapped again. */
+	lock_acquire (&frame_lock);
+	if (page_wait_writeback (page) != NULL) {
+		lock_release (&frame_lock);
+		ok = true;
+	} else {
+		lock_release (&frame_lock);
+		ok = vm_do_claim_page (page);
+	}
 
-	return vm_do_claim_page (page);
+	fault_account (start, found);
+	return ok;
+}
+
+/* Charges a page fault that started at time START, and found its
+ * page in the page table at time FOUND, to the statistics. */
+static void
+fault_account (uint64_t start, uint64_t found) {
+	uint64_t end = rdtsc ();
+	enum intr_level old_level = intr_disable ();
+
+	faults++;
+	fault_cycles += end - start;
+	lookup_cycles += found - start;
+	intr_set_level (old_level);
 }
 
 /* Free the page.
@@ -150,9 +824,15 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+
+	page = spt_find_page (spt, va);
+	if (page == NULL)
+		page = vma_fault (spt, va);
+	if (page == NULL)
+		return false;
 
 	return vm_do_claim_page (page);
 }
@@ -162,29 +842,114 @@ static bool
 vm_do_claim_page (struct page *page) {
 	struct frame *frame = vm_get_frame ();
 
+	if (frame == NULL)
+		return false;
+
 	/* Set links */
 	frame->page = page;
+	frame->owner = thread_current ();
+	frame->pml4 = frame->owner->pml4;
+	frame->last_use = frame->owner->run_ticks;
 	page->frame = frame;
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	/* Fill the frame before mapping it, so that the process never
+	 * sees what the frame held before. */
+	if (!swap_in (page, frame->kva)
+			|| !pml4_set_page (frame->pml4, page->va, frame->kva,
+				page->writable)) {
+		page->frame = NULL;
+		frame->page = NULL;
+		frame_free (frame);
+		return false;
+	}
 
-	return swap_in (page, frame->kva);
+	/* The page may be evicted from now on. */
+	frame->pinned = false;
+	return true;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->root = 0;
+	vma_init (spt);
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct rb_elem *e;
+
+	ASSERT (dst == &thread_current ()->spt);
+
+	for (e = rb_first (&src->vmas); e != NULL; e = rb_next (e)) {
+		struct vma *vma = rb_entry (e, struct vma, elem);
+
+		if (vma_insert (dst, vma->start, vma->end, vma->type, vma->writable,
+					vma->file, vma->offset, vma->read_bytes) == NULL)
+			return false;
+	}
+	return spt_for_each (src, NULL, (void *) KERN_BASE, page_copy, dst);
+}
+
+/* Creates a copy in DST, the running process's page table, of
+ * SRC's page PAGE.  Pages never touched are left out: the copy of
+ * their area creates them when they are. */
+static bool
+page_copy (struct page *page, void *dst_) {
+	struct supplemental_page_table *dst = dst_;
+	struct vma *vma;
+
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return true;
+
+	vma = vma_find (dst, page->va);
+	ASSERT (vma != NULL);
+	return vm_alloc_page_with_initializer (vma->type, page->va,
+			page->writable, page_copy_load, page)
+		&& vm_do_claim_page (spt_find_page (dst, page->va));
+}
+
+/* Fills PAGE, which is being claimed, with the contents of AUX,
+ * the page it copies.  AUX's process waits in fork() meanwhile,
+ * so AUX can only be evicted, not changed. */
+static bool
+page_copy_load (struct page *page, void *aux) {
+	struct page *src = aux;
+	struct frame *frame;
+	bool pinned;
+
+	/* Keep the page in its frame while it is copied. */
+	lock_acquire (&frame_lock);
+	frame = page_wait_writeback (src);
+	if (frame != NULL) {
+		pinned = frame->pinned;
+		frame->pinned = true;
+		lock_release (&frame_lock);
+		memcpy (page->frame->kva, frame->kva, PGSIZE);
+		lock_acquire (&frame_lock);
+		frame->pinned = pinned;
+		lock_release (&frame_lock);
+		return true;
+	}
+	lock_release (&frame_lock);
+
+	/* Otherwise it is in swap, or unchanged in its file. */
+	switch (page_get_type (src)) {
+		case VM_ANON:
+			return anon_swap_copy (src, page->frame->kva);
+		case VM_FILE:
+			return swap_in (src, page->frame->kva);
+		default:
+			return false;
+	}
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	/* Destroying each page writes back its modified contents. */
+	vma_remove_all (spt);
+	spt_remove_range (spt, NULL, (void *) KERN_BASE);
 }
@@ -0,0 +1,166 @@
+/* vma.c: Virtual memory areas of a process. */
+
+#include "vm/vma.h"
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Slab cache for `struct vma's. */
+static struct kmem_cache *vma_cache;
+
+static bool vma_less (const struct rb_elem *, const struct rb_elem *,
+		void *aux);
+static bool vma_load (struct page *, void *aux);
+
+/* Initializes the VMA allocator. */
+void
+vm_vma_init (void) {
+	vma_cache = kmem_cache_create ("vma", sizeof (struct vma), 0, NULL);
+}
+
+/* Initializes SPT's tree of areas to be empty. */
+void
+vma_init (struct supplemental_page_table *spt) {
+	rb_init (&spt->vmas, vma_less, NULL);
+}
+
+/* Returns the area in SPT with the greatest start address at or
+ * below ADDR, or a null pointer if there is none. */
+static struct vma *
+vma_floor (struct supplemental_page_table *spt, const void *addr) {
+	struct vma key;
+	struct rb_elem *e;
+
+	key.start = (void *) addr;
+	e = rb_floor (&spt->vmas, &key.elem);
+	return e != NULL ? rb_entry (e, struct vma, elem) : NULL;
+}
+
+/* Creates an area in SPT for the pages in [START, END), with
+ * pages of type TYPE, writable if WRITABLE.  The first
+ * READ_BYTES bytes are read from FILE starting at OFFSET, and the
+ * rest are zeroed.  FILE may be null if READ_BYTES is 0;
+ * otherwise the area keeps its own reference to FILE.  Returns
+ * the new area, or a null pointer if it would overlap another
+ * one or if memory runs out. */
+struct vma *
+vma_insert (struct supplemental_page_table *spt, void *start, void *end,
+		enum vm_type type, bool writable, struct file *file, off_t offset,
+		size_t read_bytes) {
+	struct vma *vma;
+
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT (start < end);
+	ASSERT (read_bytes <= (size_t) (end - start));
+	ASSERT (file != NULL || read_bytes == 0);
+
+	if (!is_user_vaddr (end - 1) || vma_overlaps (spt, start, end))
+		return NULL;
+
+	vma = kmem_cache_alloc (vma_cache);
+	if (vma == NULL)
+		return NULL;
+	vma->start = start;
+	vma->end = end;
+	vma->type = type;
+	vma->writable = writable;
+	vma->file = NULL;
+	vma->offset = offset;
+	vma->read_bytes = read_bytes;
+	if (file != NULL) {
+		vma->file = file_reopen (file);
+		if (vma->file == NULL) {
+			kmem_cache_free (vma_cache, vma);
+			return NULL;
+		}
+	}
+	rb_insert (&spt->vmas, &vma->elem);
+	return vma;
+}
+
+/* Returns the area in SPT that contains ADDR, or a null pointer
+ * if there is none. */
+struct vma *
+vma_find (struct supplemental_page_table *spt, const void *addr) {
+	struct vma *vma = vma_floor (spt, addr);
+
+	return vma != NULL && addr < vma->end ? vma : NULL;
+}
+
+/* Returns true if any area in SPT overlaps [START, END). */
+bool
+vma_overlaps (struct supplemental_page_table *spt, const void *start,
+		const void *end) {
+	struct vma *vma = vma_floor (spt, start);
+	struct rb_elem *next;
+
+	if (vma != NULL && start < vma->end)
+		return true;
+	next = vma != NULL ? rb_next (&vma->elem) : rb_first (&spt->vmas);
+	return next != NULL && rb_entry (next, struct vma, elem)->start < end;
+}
+
+/* Removes VMA from SPT and frees it, along with the pages that
+ * have been created in it. */
+void
+vma_remove (struct supplemental_page_table *spt, struct vma *vma) {
+	spt_remove_range (spt, vma->start, vma->end);
+	rb_remove (&spt->vmas, &vma->elem);
+	file_close (vma->file);
+	kmem_cache_free (vma_cache, vma);
+}
+
+/* Removes and frees every area in SPT. */
+void
+vma_remove_all (struct supplemental_page_table *spt) {
+	while (!rb_empty (&spt->vmas))
+		vma_remove (spt, rb_entry (rb_first (&spt->vmas), struct vma, elem));
+}
+
+/* Creates the page at ADDR in the current process's SPT, which
+ * must not exist yet, from the area that contains it.  Returns
+ * the page, or a null pointer if ADDR is in no area or memory
+ * runs out. */
+struct page *
+vma_fault (struct supplemental_page_table *spt, void *addr) {
+	struct vma *vma = vma_find (spt, addr);
+	void *upage = pg_round_down (addr);
+
+	ASSERT (spt == &thread_current ()->spt);
+
+	if (vma == NULL || !vm_alloc_page_with_initializer (vma->type, upage,
+				vma->writable, vma_load, vma))
+		return NULL;
+	return spt_find_page (spt, upage);
+}
+
+/* Fills PAGE, in area AUX, from the area's file and with zeros. */
+static bool
+vma_load (struct page *page, void *aux) {
+	struct vma *vma = aux;
+	size_t ofs = (uint8_t *) page->va - (uint8_t *) vma->start;
+	size_t bytes = 0;
+	void *kva = page->frame->kva;
+
+	if (ofs < vma->read_bytes) {
+		bytes = vma->read_bytes - ofs < PGSIZE ? vma->read_bytes - ofs : PGSIZE;
+		if (file_read_at (vma->file, kva, bytes, vma->offset + ofs)
+				!= (off_t) bytes)
+			return false;
+	}
+	memset ((uint8_t *) kva + bytes, 0, PGSIZE - bytes);
+	return true;
+}
+
+/* Orders areas by start address. */
+static bool
+vma_less (const struct rb_elem *a_, const struct rb_elem *b_,
+		void *aux UNUSED) {
+	const struct vma *a = rb_entry (a_, struct vma, elem);
+	const struct vma *b = rb_entry (b_, struct vma, elem);
+
+	return a->start < b->start;
+}